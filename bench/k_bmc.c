@@ -0,0 +1,105 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+/* motion compensation kernels */
+
+#include "../bmc.c"
+#include "kbench.h"
+
+typedef void (*HPEL_FN)(uint8_t *dec, uint8_t *ref, int xh, int yh, int dw, int rw, int w, int h);
+typedef void (*ADDSUB_FN)(uint8_t *a, int as, uint8_t *b, int bs, int w, int h);
+
+/* every block uses a different one of the four half-pel phases */
+static unsigned long
+run_blocks(HPEL_FN hp, KB_INPUT *in, uint8_t *out, int bsz)
+{
+    DSV_PLANE *b = in->b->planes;
+    int x, y, k = 0;
+    
+    for (y = 0; y + bsz <= in->h; y += bsz) {
+        for (x = 0; x + bsz <= in->w; x += bsz) {
+            hp(out + y * in->w + x, DSV_GET_XY(b, x, y),
+               (k >> 1) & 1, k & 1, in->w, b->stride, bsz, bsz);
+            k++;
+        }
+    }
+    return (unsigned long) in->w * in->h;
+}
+
+static unsigned long
+run_hpel(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    return run_blocks((HPEL_FN) fn, in, out, 8);
+}
+
+static unsigned long
+run_hpelL(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    return run_blocks((HPEL_FN) fn, in, out, 16);
+}
+
+/* addf / subf work in place */
+static void
+prep_addsub(KB_INPUT *in, uint8_t *out)
+{
+    DSV_PLANE *a = in->a->planes;
+    int y;
+    
+    for (y = 0; y < in->h; y++) {
+        memcpy(out + y * in->w, DSV_GET_LINE(a, y), in->w);
+    }
+}
+
+static unsigned long
+run_addsub(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    ADDSUB_FN f = (ADDSUB_FN) fn;
+    DSV_PLANE *b = in->b->planes;
+    
+    f(out, in->w, b->data, b->stride, in->w, in->h);
+    return (unsigned long) in->w * in->h;
+}
+
+KB_KERNEL kb_bmc_kernels[] = {
+    { "addf", "pixel", NULL, prep_addsub, run_addsub,
+        { { "c", (KB_FN) addf, 0 },
+#if BMC_SIMD
+          { "sse2", (KB_FN) addf_sse2, DSV_CPU_SSE2 },
+          { "avx2", (KB_FN) addf_avx2, DSV_CPU_AVX2 },
+#endif
+          { NULL, NULL, 0 } } },
+    { "subf", "pixel", NULL, prep_addsub, run_addsub,
+        { { "c", (KB_FN) subf, 0 },
+#if BMC_SIMD
+          { "sse2", (KB_FN) subf_sse2, DSV_CPU_SSE2 },
+          { "avx2", (KB_FN) subf_avx2, DSV_CPU_AVX2 },
+#endif
+          { NULL, NULL, 0 } } },
+    { "bmc_hpel", "pixel", NULL, NULL, run_hpel,
+        { { "c", (KB_FN) hpel, 0 },
+#if BMC_SIMD
+          { "sse2", (KB_FN) hpel_sse2, DSV_CPU_SSE2 },
+#endif
+          { NULL, NULL, 0 } } },
+    { "hpelL", "pixel", NULL, NULL, run_hpelL,
+        { { "c", (KB_FN) hpelL, 0 },
+#if BMC_SIMD
+          { "sse2", (KB_FN) hpelL_sse2, DSV_CPU_SSE2 },
+          { "avx2", (KB_FN) hpelL_avx2, DSV_CPU_AVX2 },
+#endif
+          { NULL, NULL, 0 } } },
+    { NULL, NULL, NULL, NULL, NULL, { { NULL, NULL, 0 } } }
+};
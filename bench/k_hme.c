@@ -0,0 +1,143 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+/* motion estimation kernels */
+
+#include "../hme.c"
+#include "kbench.h"
+
+typedef int (*SAD_FN)(uint8_t *a, int as, uint8_t *b, int bs, int w, int h);
+typedef int (*HPSAD_FN)(uint8_t *a, int as, uint8_t *b);
+typedef void (*HPEL_FN)(uint8_t *dec, uint8_t *ref, int rw);
+typedef unsigned (*ANALYSIS_FN)(DSV_PLANE *p, int w, int h, unsigned *texture, int *avg);
+
+#define HP_BUF ((2 + HP_STRIDE) * (2 + HP_STRIDE))
+#define KB_BLK 16
+
+static int sad_widths[] = { 16, 24, 32, 48, 64, 20 };
+
+static unsigned long
+run_sad(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    SAD_FN sad = (SAD_FN) fn;
+    DSV_PLANE *a = in->a->planes;
+    DSV_PLANE *b = in->b->planes;
+    int32_t *res = (int32_t *) out;
+    unsigned long n = 0;
+    int i, x, y, bw;
+    
+    for (i = 0; i < (int) (sizeof(sad_widths) / sizeof(*sad_widths)); i++) {
+        bw = sad_widths[i];
+        for (y = 0; y + KB_BLK <= in->h; y += KB_BLK) {
+            for (x = 0; x + bw <= in->w; x += bw) {
+                *res++ = sad(DSV_GET_XY(a, x, y), a->stride,
+                             DSV_GET_XY(b, x + 1, y + 1), b->stride, bw, KB_BLK);
+                n += bw * KB_BLK;
+            }
+        }
+    }
+    return n;
+}
+
+static unsigned long
+run_analysis(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    ANALYSIS_FN an = (ANALYSIS_FN) fn;
+    DSV_PLANE p;
+    int32_t *res = (int32_t *) out;
+    unsigned long n = 0;
+    unsigned tex;
+    int i, x, y, bw, avg;
+    
+    for (i = 0; i < (int) (sizeof(sad_widths) / sizeof(*sad_widths)); i++) {
+        bw = sad_widths[i];
+        for (y = 0; y + KB_BLK <= in->h; y += KB_BLK) {
+            for (x = 0; x + bw <= in->w; x += bw) {
+                dsv_plane_xy(in->a, &p, 0, x, y);
+                *res++ = an(&p, bw, KB_BLK, &tex, &avg);
+                *res++ = tex;
+                *res++ = avg;
+                n += bw * KB_BLK;
+            }
+        }
+    }
+    return n;
+}
+
+static unsigned long
+run_hpel(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    HPEL_FN hp = (HPEL_FN) fn;
+    DSV_PLANE *b = in->b->planes;
+    int x, y;
+    
+    for (y = 0; y + KB_BLK <= in->h; y += KB_BLK) {
+        for (x = 0; x + KB_BLK <= in->w; x += KB_BLK) {
+            hp(out, DSV_GET_XY(b, x, y) - 1 - b->stride, b->stride);
+            out += HP_BUF;
+        }
+    }
+    return (unsigned long) (in->w / KB_BLK) * (in->h / KB_BLK) * HP_STRIDE * HP_STRIDE;
+}
+
+/* half-pel blocks of b to search in, made once with the reference hpel */
+static void
+init_hpsad(KB_INPUT *in)
+{
+    if (in->hp == NULL) {
+        in->hp = malloc((in->w / KB_BLK) * (in->h / KB_BLK) * HP_BUF);
+        run_hpel((KB_FN) hpel, in, in->hp);
+    }
+}
+
+static unsigned long
+run_hpsad(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    static int kxh[8] = { 1, -1, 0,  0, -1,  1, -1, 1 };
+    static int kyh[8] = { 0,  0, 1, -1, -1, -1,  1, 1 };
+    HPSAD_FN sad = (HPSAD_FN) fn;
+    DSV_PLANE *a = in->a->planes;
+    int32_t *res = (int32_t *) out;
+    uint8_t *hp = in->hp;
+    unsigned long n = 0;
+    int k, x, y;
+    
+    for (y = 0; y + KB_BLK <= in->h; y += KB_BLK) {
+        for (x = 0; x + KB_BLK <= in->w; x += KB_BLK) {
+            uint8_t *tmph = hp + 2 + 2 * HP_STRIDE;
+            
+            for (k = 0; k < 8; k++) {
+                *res++ = sad(DSV_GET_XY(a, x + 1, y + 1), a->stride,
+                             tmph + kxh[k] + kyh[k] * HP_STRIDE);
+            }
+            n += 8 * HP_SAD_SZ * HP_SAD_SZ;
+            hp += HP_BUF;
+        }
+    }
+    return n;
+}
+
+KB_KERNEL kb_hme_kernels[] = {
+    { "fastsad", "pixel", NULL, NULL, run_sad,
+        { { "generic", (KB_FN) sad_wxh, 0 }, { "c", (KB_FN) fastsad, 0 }, { NULL, NULL, 0 } } },
+    { "analysis", "pixel", NULL, NULL, run_analysis,
+        { { "generic", (KB_FN) block_analysis, 0 }, { "c", (KB_FN) fast_analysis, 0 }, { NULL, NULL, 0 } } },
+    { "hpsad", "pixel", init_hpsad, NULL, run_hpsad,
+        { { "c", (KB_FN) hpsad, 0 }, { NULL, NULL, 0 } } },
+    { "hme_hpel", "pixel", NULL, NULL, run_hpel,
+        { { "c", (KB_FN) hpel, 0 }, { NULL, NULL, 0 } } },
+    { NULL, NULL, NULL, NULL, NULL, { { NULL, NULL, 0 } } }
+};
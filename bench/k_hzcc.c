@@ -0,0 +1,59 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+/* quantization kernels */
+
+#include "../hzcc.c"
+#include "kbench.h"
+
+typedef int (*QUANT_FN)(DSV_SBC v, int q);
+typedef DSV_SBC (*DEQUANT_FN)(int v, int q);
+
+#define KB_Q 40
+
+static unsigned long
+run_quant(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    QUANT_FN f = (QUANT_FN) fn;
+    int *res = (int *) out;
+    int i;
+    
+    for (i = 0; i < in->nsym; i++) {
+        res[i] = f(in->coefs[i], KB_Q);
+    }
+    return in->nsym;
+}
+
+static unsigned long
+run_dequant(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    DEQUANT_FN f = (DEQUANT_FN) fn;
+    DSV_SBC *res = (DSV_SBC *) out;
+    int i;
+    
+    for (i = 0; i < in->nsym; i++) {
+        res[i] = f(in->syms[i], KB_Q);
+    }
+    return in->nsym;
+}
+
+KB_KERNEL kb_hzcc_kernels[] = {
+    { "quant", "symbol", NULL, NULL, run_quant,
+        { { "c", (KB_FN) quant, 0 }, { NULL, NULL, 0 } } },
+    { "dequant", "symbol", NULL, NULL, run_dequant,
+        { { "c", (KB_FN) dequant, 0 }, { NULL, NULL, 0 } } },
+    { NULL, NULL, NULL, NULL, NULL, { { NULL, NULL, 0 } } }
+};
@@ -0,0 +1,101 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+/* subband transform kernels */
+
+#include "../sbt.c"
+#include "kbench.h"
+
+typedef void (*LVL_FN)(DSV_SBC *src, DSV_SBC *dst, int width, int height, int lvl, int isI);
+typedef void (*INV_FN)(DSV_SBC *src, DSV_SBC *dst, int width, int height, int lvl, int hqp, int isI);
+typedef void (*B4T_FN)(DSV_SBC *tmp, DSV_SBC *in, int w, int h);
+
+#define KB_HQP 8
+
+/* 'out' holds the coefficients being transformed followed by the scratch */
+#define WORK(out) ((DSV_SBC *) (out))
+#define TEMP(in, out) (WORK(out) + (in)->w * (in)->h + (in)->w)
+
+static void
+prep_pix(KB_INPUT *in, uint8_t *out)
+{
+    memcpy(out, in->pix, in->w * in->h * sizeof(DSV_SBC));
+}
+
+static void
+prep_coefs(KB_INPUT *in, uint8_t *out)
+{
+    memcpy(out, in->coefs, in->w * in->h * sizeof(DSV_SBC));
+}
+
+static unsigned long
+run_fwd(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    LVL_FN f = (LVL_FN) fn;
+    int i, lvls = nlevels(in->w, in->h);
+    
+    for (i = 1; i <= lvls; i++) {
+        f(WORK(out), TEMP(in, out), in->w, in->h, i, 0);
+    }
+    return (unsigned long) in->w * in->h;
+}
+
+static unsigned long
+run_inv_simple(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    LVL_FN f = (LVL_FN) fn;
+    int i;
+    
+    for (i = nlevels(in->w, in->h); i > 0; i--) {
+        f(WORK(out), TEMP(in, out), in->w, in->h, i, 0);
+    }
+    return (unsigned long) in->w * in->h;
+}
+
+static unsigned long
+run_inv(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    INV_FN f = (INV_FN) fn;
+    int i;
+    
+    for (i = nlevels(in->w, in->h); i > 0; i--) {
+        f(WORK(out), TEMP(in, out), in->w, in->h, i, KB_HQP, 0);
+    }
+    return (unsigned long) in->w * in->h;
+}
+
+static unsigned long
+run_b4t(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    B4T_FN f = (B4T_FN) fn;
+    
+    f(TEMP(in, out), WORK(out), in->w, in->h);
+    return (unsigned long) in->w * in->h;
+}
+
+KB_KERNEL kb_sbt_kernels[] = {
+    { "fwd", "pixel", NULL, prep_pix, run_fwd,
+        { { "c", (KB_FN) fwd, 0 }, { NULL, NULL, 0 } } },
+    { "inv", "pixel", NULL, prep_coefs, run_inv,
+        { { "c", (KB_FN) inv, 0 }, { NULL, NULL, 0 } } },
+    { "inv_simple", "pixel", NULL, prep_coefs, run_inv_simple,
+        { { "c", (KB_FN) inv_simple, 0 }, { NULL, NULL, 0 } } },
+    { "fwd_b4t_2d", "pixel", NULL, prep_pix, run_b4t,
+        { { "c", (KB_FN) fwd_b4t_2d, 0 }, { NULL, NULL, 0 } } },
+    { "inv_b4t_2d", "pixel", NULL, prep_coefs, run_b4t,
+        { { "c", (KB_FN) inv_b4t_2d, 0 }, { NULL, NULL, 0 } } },
+    { NULL, NULL, NULL, NULL, NULL, { { NULL, NULL, 0 } } }
+};
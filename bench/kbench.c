@@ -0,0 +1,372 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+/* Kernel Microbenchmarks
+ *
+ * usage: kbench [-inp_<file.yuv> -w<n> -h<n>] [-k<name>] [-ms<n>] [-mhz<n>]
+ *
+ * times every implementation of every kernel on random content, and on the
+ * first two frames of a 4:2:0 video if one is given, and checks that every
+ * implementation matches the reference bit for bit.
+ */
+
+#include "kbench.h"
+#include "../platform.h"
+
+#include <stdio.h>
+
+#define KB_RAND_W 640
+#define KB_RAND_H 384
+
+typedef void (*PUT_FN)(DSV_BS *bs, unsigned v);
+typedef unsigned (*GET_FN)(DSV_BS *bs);
+
+static struct {
+    char *inp;
+    int w, h;
+    char *only; /* run only kernels containing this */
+    int ms; /* minimum time to measure for */
+    int mhz; /* to convert time to cycles, 0 = unknown */
+} opts = { NULL, 352, 288, NULL, 100, 0 };
+
+static unsigned rng = 1;
+
+/* small LCG so the random content is the same everywhere */
+static unsigned
+kb_rand(void)
+{
+    rng = rng * 1103515245u + 12345u;
+    return (rng >> 16) & 0x7fff;
+}
+
+static void
+prep_put(KB_INPUT *in, uint8_t *out)
+{
+    memset(out, 0, in->nsym * 8);
+}
+
+static unsigned long
+run_put(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    PUT_FN f = (PUT_FN) fn;
+    DSV_BS bs;
+    int i;
+    
+    dsv_bs_init(&bs, out);
+    for (i = 0; i < in->nsym; i++) {
+        f(&bs, abs(in->syms[i]));
+    }
+    return in->nsym;
+}
+
+static unsigned long
+run_get(KB_FN fn, KB_INPUT *in, uint8_t *out)
+{
+    GET_FN f = (GET_FN) fn;
+    unsigned *res = (unsigned *) out;
+    DSV_BS bs;
+    int i;
+    
+    dsv_bs_init(&bs, in->stream);
+    for (i = 0; i < in->nsym; i++) {
+        res[i] = f(&bs);
+    }
+    return in->nsym;
+}
+
+KB_KERNEL kb_bs_kernels[] = {
+    { "put_ueg", "symbol", NULL, prep_put, run_put,
+        { { "c", (KB_FN) dsv_bs_put_ueg, 0 }, { NULL, NULL, 0 } } },
+    { "get_ueg", "symbol", NULL, NULL, run_get,
+        { { "c", (KB_FN) dsv_bs_get_ueg, 0 }, { NULL, NULL, 0 } } },
+    { NULL, NULL, NULL, NULL, NULL, { { NULL, NULL, 0 } } }
+};
+
+static KB_KERNEL *all_kernels[] = {
+    kb_hme_kernels,
+    kb_bmc_kernels,
+    kb_sbt_kernels,
+    kb_hzcc_kernels,
+    kb_bs_kernels,
+    NULL
+};
+
+static KB_INPUT *
+mk_input(char *name, uint8_t *luma0, uint8_t *luma1, int w, int h)
+{
+    KB_INPUT *in;
+    DSV_PLANE *a, *b;
+    DSV_COEFS c;
+    DSV_BS bs;
+    int x, y, i;
+    
+    in = calloc(1, sizeof(*in));
+    in->name = name;
+    in->w = w & ~63;
+    in->h = h & ~63;
+    in->a = dsv_mk_frame(DSV_SUBSAMP_444, in->w, in->h, 1);
+    in->b = dsv_mk_frame(DSV_SUBSAMP_444, in->w, in->h, 1);
+    a = in->a->planes;
+    b = in->b->planes;
+    for (y = 0; y < in->h; y++) {
+        if (luma0) {
+            memcpy(DSV_GET_LINE(a, y), luma0 + y * w, in->w);
+        } else {
+            for (x = 0; x < in->w; x++) {
+                DSV_GET_LINE(a, y)[x] = kb_rand();
+            }
+        }
+    }
+    dsv_extend_frame(in->a);
+    for (y = 0; y < in->h; y++) {
+        if (luma1) {
+            memcpy(DSV_GET_LINE(b, y), luma1 + y * w, in->w);
+            continue;
+        }
+        /* a moved by (3, 2) with some noise */
+        for (x = 0; x < in->w; x++) {
+            int v = *DSV_GET_XY(a, x - 3, y - 2) + (int) (kb_rand() % 5) - 2;
+            
+            DSV_GET_LINE(b, y)[x] = CLAMP(v, 0, 255);
+        }
+    }
+    dsv_extend_frame(in->b);
+    
+    in->nsym = in->w * in->h;
+    in->pix = malloc(in->nsym * sizeof(DSV_SBC));
+    in->coefs = malloc(in->nsym * sizeof(DSV_SBC));
+    in->syms = malloc(in->nsym * sizeof(int));
+    for (y = 0; y < in->h; y++) {
+        for (x = 0; x < in->w; x++) {
+            in->pix[x + y * in->w] = DSV_GET_LINE(a, y)[x] - 128;
+        }
+    }
+    c.data = in->coefs;
+    c.width = in->w;
+    c.height = in->h;
+    dsv_fwd_sbt(a, &c, 1);
+    for (i = 0; i < in->nsym; i++) {
+        in->syms[i] = in->coefs[i] / 32;
+    }
+    in->stream = calloc(in->nsym, 8);
+    dsv_bs_init(&bs, in->stream);
+    for (i = 0; i < in->nsym; i++) {
+        dsv_bs_put_ueg(&bs, abs(in->syms[i]));
+    }
+    return in;
+}
+
+static void
+free_input(KB_INPUT *in)
+{
+    dsv_frame_ref_dec(in->a);
+    dsv_frame_ref_dec(in->b);
+    free(in->pix);
+    free(in->coefs);
+    free(in->syms);
+    free(in->stream);
+    if (in->hp) {
+        free(in->hp);
+    }
+    free(in);
+}
+
+/* returns average nanoseconds per pass, with or without the kernel */
+static long
+measure(KB_KERNEL *k, KB_FN fn, KB_INPUT *in, uint8_t *out, int with_run)
+{
+    unsigned long iters = 1, i, t;
+    
+    while (1) {
+        t = dsv_usec();
+        for (i = 0; i < iters; i++) {
+            if (k->prep) {
+                k->prep(in, out);
+            }
+            if (with_run) {
+                k->run(fn, in, out);
+            }
+        }
+        t = dsv_usec() - t;
+        if (t >= (unsigned long) opts.ms * 1000 || iters >= (1UL << 30)) {
+            return (long) ((uint64_t) t * 1000 / iters);
+        }
+        iters *= 2;
+    }
+}
+
+/* returns number of implementations that did not match the reference */
+static int
+bench_kernel(KB_KERNEL *k, KB_INPUT *in, uint8_t *out, uint8_t *ref)
+{
+    unsigned long units;
+    /* ns per pass, ps and thousandths of a cycle per unit */
+    long ns, ref_ns = 0, unit_ps, unit_cyc, x;
+    int i, bad = 0;
+    size_t size = KB_OUT_SIZE(in);
+    
+    if (k->init) {
+        k->init(in);
+    }
+    for (i = 0; i < KB_MAX_IMPLS && k->impl[i].name; i++) {
+        KB_IMPL *im = &k->impl[i];
+        int exact = 1;
+        
+        if ((im->cpu & dsv_cpu_features()) != im->cpu) {
+            printf("%-12s %-8s %-8s not supported by this processor\n", k->name, im->name, in->name);
+            continue;
+        }
+        memset(out, 0, size);
+        if (k->prep) {
+            k->prep(in, out);
+        }
+        units = k->run(im->fn, in, out);
+        if (i == 0) {
+            memcpy(ref, out, size);
+        } else {
+            exact = (memcmp(ref, out, size) == 0);
+            bad += !exact;
+        }
+        
+        ns = measure(k, im->fn, in, out, 1);
+        if (k->prep) {
+            ns -= measure(k, im->fn, in, out, 0);
+        }
+        if (ns < 0) {
+            ns = 0;
+        }
+        if (i == 0) {
+            ref_ns = ns;
+        }
+        unit_ps = (long) ((uint64_t) ns * 1000 / units);
+        printf("%-12s %-8s %-8s %4ld.%03ld ns/%-6s", k->name, im->name, in->name,
+                unit_ps / 1000, unit_ps % 1000, k->unit);
+        if (opts.mhz) {
+            unit_cyc = (long) ((uint64_t) unit_ps * opts.mhz / 1000);
+            printf(" %4ld.%03ld cyc/%-6s", unit_cyc / 1000, unit_cyc % 1000, k->unit);
+        }
+        if (i == 0) {
+            printf("  %5s  reference\n", "");
+        } else {
+            x = ns > 0 ? (long) ((uint64_t) ref_ns * 100 / ns) : 0;
+            printf("  %2ld.%02ldx %s\n", x / 100, x % 100, exact ? "exact" : "MISMATCH");
+        }
+    }
+    return bad;
+}
+
+static uint8_t *
+read_luma(FILE *f, int fno, int w, int h)
+{
+    uint8_t *p;
+    long fsz = (long) w * h * 3 / 2;
+    
+    p = malloc(w * h);
+    if (p == NULL || fseek(f, fsz * fno, SEEK_SET) || fread(p, 1, w * h, f) != (size_t) (w * h)) {
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+static int
+get_opt(char *arg)
+{
+    if (!strncmp(arg, "-inp_", 5)) {
+        opts.inp = arg + 5;
+    } else if (!strncmp(arg, "-w", 2)) {
+        opts.w = atoi(arg + 2);
+    } else if (!strncmp(arg, "-h", 2)) {
+        opts.h = atoi(arg + 2);
+    } else if (!strncmp(arg, "-k", 2)) {
+        opts.only = arg + 2;
+    } else if (!strncmp(arg, "-ms", 3)) {
+        opts.ms = atoi(arg + 3);
+    } else if (!strncmp(arg, "-mhz", 4)) {
+        opts.mhz = atoi(arg + 4);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+    KB_INPUT *inputs[2];
+    KB_KERNEL **set, *k;
+    uint8_t *out, *ref;
+    int i, n, ninp = 0, bad = 0;
+    
+    for (i = 1; i < argc; i++) {
+        if (!get_opt(argv[i])) {
+            printf("usage: %s [-inp_<4:2:0 file.yuv> -w<n> -h<n>] [-k<kernel>] [-ms<n>] [-mhz<n>]\n", argv[0]);
+            printf("\t-inp_ : also run on the luma of the first two frames of a video\n");
+            printf("\t-k : only run kernels whose name contains this\n");
+            printf("\t-ms : minimum time to measure each kernel for. 100 = default\n");
+            printf("\t-mhz : clock rate of the processor, to also report cycles\n");
+            return EXIT_SUCCESS;
+        }
+    }
+    dsv_set_log_level(DSV_LEVEL_WARNING);
+    
+    inputs[ninp++] = mk_input("random", NULL, NULL, KB_RAND_W, KB_RAND_H);
+    if (opts.inp) {
+        FILE *f = fopen(opts.inp, "rb");
+        uint8_t *l0 = NULL, *l1 = NULL;
+        
+        if (f) {
+            l0 = read_luma(f, 0, opts.w, opts.h);
+            l1 = read_luma(f, 1, opts.w, opts.h);
+            fclose(f);
+        }
+        if (l0 == NULL || opts.w < 64 || opts.h < 64) {
+            printf("could not read a %dx%d frame from %s\n", opts.w, opts.h, opts.inp);
+            return EXIT_FAILURE;
+        }
+        inputs[ninp++] = mk_input("real", l0, l1, opts.w, opts.h);
+        free(l0);
+        if (l1) {
+            free(l1);
+        }
+    }
+    
+    for (n = 0; n < ninp; n++) {
+        out = malloc(KB_OUT_SIZE(inputs[n]));
+        ref = malloc(KB_OUT_SIZE(inputs[n]));
+        if (out == NULL || ref == NULL) {
+            printf("out of memory\n");
+            return EXIT_FAILURE;
+        }
+        for (set = all_kernels; *set; set++) {
+            for (k = *set; k->name; k++) {
+                if (opts.only && !strstr(k->name, opts.only)) {
+                    continue;
+                }
+                bad += bench_kernel(k, inputs[n], out, ref);
+            }
+        }
+        free(out);
+        free(ref);
+        free_input(inputs[n]);
+    }
+    if (bad) {
+        printf("%d implementation(s) did not match the reference!\n", bad);
+        return EXIT_FAILURE;
+    }
+    printf("all implementations match the reference\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+#ifndef _KBENCH_H_
+#define _KBENCH_H_
+
+/* Kernel Microbenchmarks
+ *
+ * Each k_*.c file includes one of the codec source files so it can reach
+ * the static kernels inside, and describes them with a table of KB_KERNEL.
+ * Faster variants of a kernel are added to its impl list, kbench times
+ * every implementation and checks that each one produces exactly the same
+ * output as the first (the C reference).
+ */
+
+#include "../dsv_internal.h"
+
+/* test content, every kernel reads from this */
+typedef struct {
+    char *name;
+    int w, h; /* multiples of 64 */
+    DSV_FRAME *a; /* luma of a picture */
+    DSV_FRAME *b; /* luma of the next picture, or a displaced copy of a */
+    DSV_SBC *pix; /* plane a as subband transform input */
+    DSV_SBC *coefs; /* plane a, subband transformed */
+    int nsym;
+    int *syms; /* coefs, quantized */
+    uint8_t *stream; /* syms written as unsigned exp-golomb codes */
+    uint8_t *hp; /* scratch for kernels that need more prepared input */
+} KB_INPUT;
+
+/* bytes of output / scratch a kernel may use, all of it is compared */
+#define KB_OUT_SIZE(in) ((in)->w * (in)->h * 16 + 65536)
+
+/* generic pointer to a kernel, cast back to its real type to call it */
+typedef void (*KB_FN)(void);
+
+typedef struct {
+    char *name;
+    KB_FN fn;
+    int cpu; /* DSV_CPU_* features it needs, skipped if not available */
+} KB_IMPL;
+
+#define KB_MAX_IMPLS 8
+
+typedef struct {
+    char *name;
+    char *unit; /* what throughput is counted in */
+    /* optional, called once for every input before anything is run */
+    void (*init)(KB_INPUT *in);
+    /* optional, puts 'out' into the state the kernel expects. timed along
+     * with every run and then subtracted */
+    void (*prep)(KB_INPUT *in, uint8_t *out);
+    /* one pass of the kernel over the input, returns number of units */
+    unsigned long (*run)(KB_FN fn, KB_INPUT *in, uint8_t *out);
+    KB_IMPL impl[KB_MAX_IMPLS]; /* impl[0] is the reference, NULL terminated */
+} KB_KERNEL;
+
+/* NULL name terminated */
+extern KB_KERNEL kb_hme_kernels[];
+extern KB_KERNEL kb_bmc_kernels[];
+extern KB_KERNEL kb_sbt_kernels[];
+extern KB_KERNEL kb_hzcc_kernels[];
+extern KB_KERNEL kb_bs_kernels[];
+
+#endif
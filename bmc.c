@@ -15,6 +15,14 @@
 /*****************************************************************************/
 
 #include "dsv_internal.h"
+#include "platform.h"
+
+#if DSV_SIMD && defined(__GNUC__) && defined(__SSE2__)
+#define BMC_SIMD 1
+#include <immintrin.h>
+#else
+#define BMC_SIMD 0
+#endif
 
 static uint8_t
 clamp_u8(int v)
@@ -124,7 +132,7 @@ hpfv(uint8_t *p, int s)
 static void
 hpelL(uint8_t *dec, uint8_t *ref, int xh, int yh, int dw, int rw, int w, int h)
 {
-    static int16_t buf[(DSV_MAX_BLOCK_SIZE + 16) * (DSV_MAX_BLOCK_SIZE + 16)];
+    int16_t buf[(DSV_MAX_BLOCK_SIZE + 16) * (DSV_MAX_BLOCK_SIZE + 16)];
     int x, y, i, c;
     
     switch ((xh << 1) | yh) {
@@ -188,6 +196,574 @@ avgval(uint8_t *dec, int dw, int w, int h)
     return avg / (w * h);
 }
 
+/* the same kernels made for each block width the codec uses, knowing the
+ * width at compile time lets the compiler unroll and vectorize the rows.
+ * 16 pixel wide luma blocks are left to hpelL, compilers already do as
+ * well or better with the generic loop there */
+#define MAKE_HPELL(n)                                                         \
+static void                                                                   \
+hpelL_ ##n(uint8_t *dec, uint8_t *ref, int xh, int yh, int dw, int rw, int w, int h)\
+{                                                                             \
+    int16_t buf[(DSV_MAX_BLOCK_SIZE + 16) * (DSV_MAX_BLOCK_SIZE + 16)];       \
+    int x, y, i, c;                                                           \
+    (void) w;                                                                 \
+    switch ((xh << 1) | yh) {                                                 \
+        case 0:                                                               \
+            for (y = 0; y < h; y++) {                                         \
+                memcpy(dec, ref, n);                                          \
+                ref += rw;                                                    \
+                dec += dw;                                                    \
+            }                                                                 \
+            break;                                                            \
+        case 1:                                                               \
+            for (y = 0; y < h; y++) {                                         \
+                for (x = 0; x < n; x++) {                                     \
+                    dec[x] = clamp_u8((hpfv(ref + x, rw) + 8) >> 4);          \
+                }                                                             \
+                ref += rw;                                                    \
+                dec += dw;                                                    \
+            }                                                                 \
+            break;                                                            \
+        case 2:                                                               \
+            for (y = 0; y < h; y++) {                                         \
+                for (x = 0; x < n; x++) {                                     \
+                    dec[x] = clamp_u8((hpfh(ref + x) + 8) >> 4);              \
+                }                                                             \
+                ref += rw;                                                    \
+                dec += dw;                                                    \
+            }                                                                 \
+            break;                                                            \
+        case 3:                                                               \
+            for (y = 0; y < h + 4; y++) {                                     \
+                for (x = 0; x < n; x++) {                                     \
+                    buf[y * n + x] = hpfh(ref + (y - 1) * rw + x);            \
+                }                                                             \
+            }                                                                 \
+            for (y = 0; y < h; y++) {                                         \
+                for (x = 0; x < n; x++) {                                     \
+                    i = y * n + x;                                            \
+                    c = DSV_HP_COEF * (buf[i + 1 * n] + buf[i + 2 * n])       \
+                                    - (buf[i + 0 * n] + buf[i + 3 * n]);      \
+                    dec[x] = clamp_u8((c + 128) >> 8);                        \
+                }                                                             \
+                dec += dw;                                                    \
+            }                                                                 \
+            break;                                                            \
+    }                                                                         \
+}
+
+MAKE_HPELL(24)
+MAKE_HPELL(32)
+MAKE_HPELL(48)
+MAKE_HPELL(64)
+
+#define MAKE_AVGVAL(n)                                                        \
+static int                                                                    \
+avgval_ ##n(uint8_t *dec, int dw, int w, int h)                               \
+{                                                                             \
+    int i, j;                                                                 \
+    int avg = 0;                                                              \
+    (void) w;                                                                 \
+    for (j = 0; j < h; j++) {                                                 \
+        for (i = 0; i < n; i++) {                                             \
+            avg += dec[i];                                                    \
+        }                                                                     \
+        dec += dw;                                                            \
+    }                                                                         \
+    return avg / (n * h);                                                     \
+}
+
+MAKE_AVGVAL(8)
+MAKE_AVGVAL(12)
+MAKE_AVGVAL(16)
+MAKE_AVGVAL(24)
+MAKE_AVGVAL(32)
+MAKE_AVGVAL(48)
+MAKE_AVGVAL(64)
+
+#if BMC_SIMD
+/* SSE2 / AVX2 versions of the kernels above, the results are exactly the
+ * same. each one does the columns that fill whole vectors and leaves the
+ * rest to the C version, every output pixel only depends on its own
+ * neighborhood so that gives the same result as doing it all in C */
+
+#define BMC_AVX2 __attribute__((target("avx2")))
+
+/* clamp_u8(a + b - 128) - 128 = (a - 128) + (b - 128) saturated to a
+ * signed byte, and the same for subtracting */
+static void
+addf_sse2(uint8_t *out, int os, uint8_t *dif, int ds, int w, int h)
+{
+    __m128i bias = _mm_set1_epi8((char) 0x80);
+    __m128i o, d;
+    int x, y, wv = w & ~15;
+
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < wv; x += 16) {
+            o = _mm_xor_si128(_mm_loadu_si128((__m128i *) (out + x)), bias);
+            d = _mm_xor_si128(_mm_loadu_si128((__m128i *) (dif + x)), bias);
+            _mm_storeu_si128((__m128i *) (out + x), _mm_xor_si128(_mm_adds_epi8(o, d), bias));
+        }
+        out += os;
+        dif += ds;
+    }
+    if (wv < w) {
+        addf(out - h * os + wv, os, dif - h * ds + wv, ds, w - wv, h);
+    }
+}
+
+static void
+subf_sse2(uint8_t *inp, int is, uint8_t *dif, int ds, int w, int h)
+{
+    __m128i bias = _mm_set1_epi8((char) 0x80);
+    __m128i a, d;
+    int x, y, wv = w & ~15;
+
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < wv; x += 16) {
+            a = _mm_xor_si128(_mm_loadu_si128((__m128i *) (inp + x)), bias);
+            d = _mm_xor_si128(_mm_loadu_si128((__m128i *) (dif + x)), bias);
+            _mm_storeu_si128((__m128i *) (inp + x), _mm_xor_si128(_mm_subs_epi8(a, d), bias));
+        }
+        inp += is;
+        dif += ds;
+    }
+    if (wv < w) {
+        subf(inp - h * is + wv, is, dif - h * ds + wv, ds, w - wv, h);
+    }
+}
+
+/* chroma blocks are often only 8 pixels wide, so 8 at a time */
+static void
+hpel_sse2(uint8_t *dec, uint8_t *ref, int xh, int yh, int dw, int rw, int w, int h)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i two = _mm_set1_epi16(2);
+    __m128i a, b, c, d;
+    uint8_t *p;
+    int i, j, wv, off;
+    
+    wv = w & ~7;
+    switch ((xh << 1) | yh) {
+        case 0:
+            wv = 0;
+            break;
+        case 1:
+        case 2:
+            /* (a + b + 1) >> 1 is exactly the byte average */
+            off = xh ? 1 : rw;
+            for (j = 0; j < h; j++) {
+                p = ref + j * rw;
+                for (i = 0; i < wv; i += 8) {
+                    a = _mm_loadl_epi64((__m128i *) (p + i));
+                    b = _mm_loadl_epi64((__m128i *) (p + i + off));
+                    _mm_storel_epi64((__m128i *) (dec + j * dw + i), _mm_avg_epu8(a, b));
+                }
+            }
+            break;
+        case 3:
+            for (j = 0; j < h; j++) {
+                p = ref + j * rw;
+                for (i = 0; i < wv; i += 8) {
+                    a = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (p + i)), zero);
+                    b = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (p + i + 1)), zero);
+                    c = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (p + i + rw)), zero);
+                    d = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) (p + i + rw + 1)), zero);
+                    a = _mm_add_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, d));
+                    a = _mm_srli_epi16(_mm_add_epi16(a, two), 2);
+                    _mm_storel_epi64((__m128i *) (dec + j * dw + i), _mm_packus_epi16(a, a));
+                }
+            }
+            break;
+    }
+    if (wv < w) {
+        hpel(dec + wv, ref + wv, xh, yh, dw, rw, w - wv, h);
+    }
+}
+
+/* 8 pixels of DSV_HP_COEF * (b + c) - (a + d) in 16 bits (fits for bytes) */
+static __m128i
+hpf8_sse2(uint8_t *a, uint8_t *b, uint8_t *c, uint8_t *d)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i coef = _mm_set1_epi16(DSV_HP_COEF);
+    __m128i bc, ad;
+    
+    bc = _mm_add_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) b), zero),
+                       _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) c), zero));
+    ad = _mm_add_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) a), zero),
+                       _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *) d), zero));
+    return _mm_sub_epi16(_mm_mullo_epi16(bc, coef), ad);
+}
+
+static void
+hpelL_sse2(uint8_t *dec, uint8_t *ref, int xh, int yh, int dw, int rw, int w, int h)
+{
+    int16_t buf[(DSV_MAX_BLOCK_SIZE + 16) * (DSV_MAX_BLOCK_SIZE + 16)];
+    __m128i eight = _mm_set1_epi16(8);
+    __m128i round = _mm_set1_epi32(128);
+    /* pairs of (b + c, a + d) times (DSV_HP_COEF, -1) */
+    __m128i coefs = _mm_set_epi16(-1, DSV_HP_COEF, -1, DSV_HP_COEF,
+                                  -1, DSV_HP_COEF, -1, DSV_HP_COEF);
+    __m128i v, b0, b1, b2, b3, s12, s03;
+    uint8_t *p;
+    int x, y, wv;
+    
+    wv = w & ~7;
+    switch ((xh << 1) | yh) {
+        case 0:
+            wv = 0;
+            break;
+        case 1:
+            for (y = 0; y < h; y++) {
+                p = ref + y * rw;
+                for (x = 0; x < wv; x += 8) {
+                    v = hpf8_sse2(p + x - rw, p + x, p + x + rw, p + x + 2 * rw);
+                    v = _mm_srai_epi16(_mm_add_epi16(v, eight), 4);
+                    _mm_storel_epi64((__m128i *) (dec + y * dw + x), _mm_packus_epi16(v, v));
+                }
+            }
+            break;
+        case 2:
+            for (y = 0; y < h; y++) {
+                p = ref + y * rw;
+                for (x = 0; x < wv; x += 8) {
+                    v = hpf8_sse2(p + x - 1, p + x, p + x + 1, p + x + 2);
+                    v = _mm_srai_epi16(_mm_add_epi16(v, eight), 4);
+                    _mm_storel_epi64((__m128i *) (dec + y * dw + x), _mm_packus_epi16(v, v));
+                }
+            }
+            break;
+        case 3:
+            for (y = 0; y < h + 4; y++) {
+                p = ref + (y - 1) * rw;
+                for (x = 0; x < wv; x += 8) {
+                    _mm_storeu_si128((__m128i *) (buf + y * wv + x),
+                            hpf8_sse2(p + x - 1, p + x, p + x + 1, p + x + 2));
+                }
+            }
+            for (y = 0; y < h; y++) {
+                for (x = 0; x < wv; x += 8) {
+                    b0 = _mm_loadu_si128((__m128i *) (buf + (y + 0) * wv + x));
+                    b1 = _mm_loadu_si128((__m128i *) (buf + (y + 1) * wv + x));
+                    b2 = _mm_loadu_si128((__m128i *) (buf + (y + 2) * wv + x));
+                    b3 = _mm_loadu_si128((__m128i *) (buf + (y + 3) * wv + x));
+                    /* the sums still fit in 16 bits, the products need 32 */
+                    s12 = _mm_add_epi16(b1, b2);
+                    s03 = _mm_add_epi16(b0, b3);
+                    b0 = _mm_madd_epi16(_mm_unpacklo_epi16(s12, s03), coefs);
+                    b1 = _mm_madd_epi16(_mm_unpackhi_epi16(s12, s03), coefs);
+                    b0 = _mm_srai_epi32(_mm_add_epi32(b0, round), 8);
+                    b1 = _mm_srai_epi32(_mm_add_epi32(b1, round), 8);
+                    v = _mm_packs_epi32(b0, b1);
+                    _mm_storel_epi64((__m128i *) (dec + y * dw + x), _mm_packus_epi16(v, v));
+                }
+            }
+            break;
+    }
+    if (wv < w) {
+        hpelL(dec + wv, ref + wv, xh, yh, dw, rw, w - wv, h);
+    }
+}
+
+static int
+avgval_sse2(uint8_t *dec, int dw, int w, int h)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    int i, j, wv;
+    int avg = 0;
+    
+    wv = w & ~7;
+    for (j = 0; j < h; j++) {
+        for (i = 0; i < wv; i += 8) {
+            acc = _mm_add_epi32(acc, _mm_sad_epu8(_mm_loadl_epi64((__m128i *) (dec + i)), zero));
+        }
+        for (; i < w; i++) {
+            avg += dec[i];
+        }
+        dec += dw;
+    }
+    avg += _mm_cvtsi128_si32(acc);
+    return avg / (w * h);
+}
+
+BMC_AVX2 static void
+addf_avx2(uint8_t *out, int os, uint8_t *dif, int ds, int w, int h)
+{
+    __m256i bias = _mm256_set1_epi8((char) 0x80);
+    __m256i o, d;
+    int x, y, wv = w & ~31;
+
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < wv; x += 32) {
+            o = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (out + x)), bias);
+            d = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (dif + x)), bias);
+            _mm256_storeu_si256((__m256i *) (out + x), _mm256_xor_si256(_mm256_adds_epi8(o, d), bias));
+        }
+        out += os;
+        dif += ds;
+    }
+    if (wv < w) {
+        addf_sse2(out - h * os + wv, os, dif - h * ds + wv, ds, w - wv, h);
+    }
+}
+
+BMC_AVX2 static void
+subf_avx2(uint8_t *inp, int is, uint8_t *dif, int ds, int w, int h)
+{
+    __m256i bias = _mm256_set1_epi8((char) 0x80);
+    __m256i a, d;
+    int x, y, wv = w & ~31;
+
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < wv; x += 32) {
+            a = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (inp + x)), bias);
+            d = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (dif + x)), bias);
+            _mm256_storeu_si256((__m256i *) (inp + x), _mm256_xor_si256(_mm256_subs_epi8(a, d), bias));
+        }
+        inp += is;
+        dif += ds;
+    }
+    if (wv < w) {
+        subf_sse2(inp - h * is + wv, is, dif - h * ds + wv, ds, w - wv, h);
+    }
+}
+
+/* 16 pixels of DSV_HP_COEF * (b + c) - (a + d) */
+BMC_AVX2 static __m256i
+hpf16_avx2(uint8_t *a, uint8_t *b, uint8_t *c, uint8_t *d)
+{
+    __m256i bc, ad;
+    
+    bc = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) b)),
+                          _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) c)));
+    ad = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) a)),
+                          _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) d)));
+    return _mm256_sub_epi16(_mm256_mullo_epi16(bc, _mm256_set1_epi16(DSV_HP_COEF)), ad);
+}
+
+/* 16 words in order to 16 clamped bytes */
+BMC_AVX2 static void
+store16_avx2(uint8_t *dst, __m256i v)
+{
+    v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0xd8);
+    _mm_storeu_si128((__m128i *) dst, _mm256_castsi256_si128(v));
+}
+
+BMC_AVX2 static void
+hpelL_avx2(uint8_t *dec, uint8_t *ref, int xh, int yh, int dw, int rw, int w, int h)
+{
+    int16_t buf[(DSV_MAX_BLOCK_SIZE + 16) * (DSV_MAX_BLOCK_SIZE + 16)];
+    __m256i eight = _mm256_set1_epi16(8);
+    __m256i round = _mm256_set1_epi32(128);
+    __m256i coefs = _mm256_set_epi16(-1, DSV_HP_COEF, -1, DSV_HP_COEF,
+                                     -1, DSV_HP_COEF, -1, DSV_HP_COEF,
+                                     -1, DSV_HP_COEF, -1, DSV_HP_COEF,
+                                     -1, DSV_HP_COEF, -1, DSV_HP_COEF);
+    __m256i v, b0, b1, b2, b3, s12, s03;
+    uint8_t *p;
+    int x, y, wv;
+    
+    wv = w & ~15;
+    switch ((xh << 1) | yh) {
+        case 0:
+            wv = 0;
+            break;
+        case 1:
+            for (y = 0; y < h; y++) {
+                p = ref + y * rw;
+                for (x = 0; x < wv; x += 16) {
+                    v = hpf16_avx2(p + x - rw, p + x, p + x + rw, p + x + 2 * rw);
+                    store16_avx2(dec + y * dw + x, _mm256_srai_epi16(_mm256_add_epi16(v, eight), 4));
+                }
+            }
+            break;
+        case 2:
+            for (y = 0; y < h; y++) {
+                p = ref + y * rw;
+                for (x = 0; x < wv; x += 16) {
+                    v = hpf16_avx2(p + x - 1, p + x, p + x + 1, p + x + 2);
+                    store16_avx2(dec + y * dw + x, _mm256_srai_epi16(_mm256_add_epi16(v, eight), 4));
+                }
+            }
+            break;
+        case 3:
+            for (y = 0; y < h + 4; y++) {
+                p = ref + (y - 1) * rw;
+                for (x = 0; x < wv; x += 16) {
+                    _mm256_storeu_si256((__m256i *) (buf + y * wv + x),
+                            hpf16_avx2(p + x - 1, p + x, p + x + 1, p + x + 2));
+                }
+            }
+            for (y = 0; y < h; y++) {
+                for (x = 0; x < wv; x += 16) {
+                    b0 = _mm256_loadu_si256((__m256i *) (buf + (y + 0) * wv + x));
+                    b1 = _mm256_loadu_si256((__m256i *) (buf + (y + 1) * wv + x));
+                    b2 = _mm256_loadu_si256((__m256i *) (buf + (y + 2) * wv + x));
+                    b3 = _mm256_loadu_si256((__m256i *) (buf + (y + 3) * wv + x));
+                    s12 = _mm256_add_epi16(b1, b2);
+                    s03 = _mm256_add_epi16(b0, b3);
+                    /* unpack and pack both work within 128 bit lanes, so
+                     * the words come out in order again */
+                    b0 = _mm256_madd_epi16(_mm256_unpacklo_epi16(s12, s03), coefs);
+                    b1 = _mm256_madd_epi16(_mm256_unpackhi_epi16(s12, s03), coefs);
+                    b0 = _mm256_srai_epi32(_mm256_add_epi32(b0, round), 8);
+                    b1 = _mm256_srai_epi32(_mm256_add_epi32(b1, round), 8);
+                    store16_avx2(dec + y * dw + x, _mm256_packs_epi32(b0, b1));
+                }
+            }
+            break;
+    }
+    if (wv < w) {
+        hpelL_sse2(dec + wv, ref + wv, xh, yh, dw, rw, w - wv, h);
+    }
+}
+#endif
+
+typedef void (*BMC_HPEL_FN)(uint8_t *dec, uint8_t *ref, int xh, int yh, int dw, int rw, int w, int h);
+typedef void (*BMC_COMBINE_FN)(uint8_t *a, int as, uint8_t *b, int bs, int w, int h);
+
+/* the kernels in use, the fastest ones the processor supports.
+ * hpelL and avgval are looked up by the width of the block */
+static struct {
+    int ready;
+    BMC_COMBINE_FN addf;
+    BMC_COMBINE_FN subf;
+    BMC_HPEL_FN hpel;
+    BMC_HPEL_FN hpelL[DSV_MAX_BLOCK_SIZE + 1];
+    int (*avgval[DSV_MAX_BLOCK_SIZE + 1])(uint8_t *dec, int dw, int w, int h);
+} kern;
+
+static void
+kern_init(void)
+{
+    int i;
+    
+    dsv_global_lock();
+    if (!kern.ready) {
+        kern.addf = addf;
+        kern.subf = subf;
+        kern.hpel = hpel;
+        for (i = 0; i <= DSV_MAX_BLOCK_SIZE; i++) {
+            kern.hpelL[i] = hpelL;
+            kern.avgval[i] = avgval;
+        }
+        kern.hpelL[24] = hpelL_24;
+        kern.hpelL[32] = hpelL_32;
+        kern.hpelL[48] = hpelL_48;
+        kern.hpelL[64] = hpelL_64;
+        kern.avgval[8] = avgval_8;
+        kern.avgval[12] = avgval_12;
+        kern.avgval[16] = avgval_16;
+        kern.avgval[24] = avgval_24;
+        kern.avgval[32] = avgval_32;
+        kern.avgval[48] = avgval_48;
+        kern.avgval[64] = avgval_64;
+#if BMC_SIMD
+        if (dsv_cpu_features() & DSV_CPU_SSE2) {
+            kern.addf = addf_sse2;
+            kern.subf = subf_sse2;
+            kern.hpel = hpel_sse2;
+            for (i = 0; i <= DSV_MAX_BLOCK_SIZE; i++) {
+                kern.hpelL[i] = hpelL_sse2;
+                kern.avgval[i] = avgval_sse2;
+            }
+        }
+        if (dsv_cpu_features() & DSV_CPU_AVX2) {
+            kern.addf = addf_avx2;
+            kern.subf = subf_avx2;
+            for (i = 0; i <= DSV_MAX_BLOCK_SIZE; i++) {
+                kern.hpelL[i] = hpelL_avx2;
+            }
+        }
+#endif
+        kern.ready = 1;
+    }
+    dsv_global_unlock();
+}
+
+/* Precomputed Half-Pixel Planes
+ *
+ * the reference interpolated once in tiles with the same filters as above.
+ * each output position only depends on its own neighborhood in the
+ * reference, so a block copied out of these planes is identical to one
+ * interpolated by hpelL / hpel.
+ * the filters reach two pixels further out than the position itself, so
+ * only DSV_HP_BORDER pixels of the border are covered. blocks reaching past
+ * that are still interpolated block by block.
+ */
+static void
+hp_fill(DSV_PLANE *rp, DSV_PLANE *hp, int c, int phase)
+{
+    int x, y, w, h, tw, th;
+    
+    w = rp->w + DSV_HP_BORDER;
+    h = rp->h + DSV_HP_BORDER;
+    for (y = -DSV_HP_BORDER; y < h; y += DSV_MAX_BLOCK_SIZE) {
+        th = MIN(DSV_MAX_BLOCK_SIZE, h - y);
+        for (x = -DSV_HP_BORDER; x < w; x += DSV_MAX_BLOCK_SIZE) {
+            tw = MIN(DSV_MAX_BLOCK_SIZE, w - x);
+            (c == 0 ? kern.hpelL[tw] : kern.hpel)
+                   (DSV_GET_XY(hp, x, y),
+                    DSV_GET_XY(rp, x, y),
+                    phase >> 1, phase & 1,
+                    hp->stride, rp->stride, tw, th);
+        }
+    }
+}
+
+extern void
+dsv_hpel_planes(DSV_FRAME *ref, DSV_FRAME **hp, int nplanes, int phases)
+{
+    int c, i;
+    
+    kern_init();
+    for (i = 0; i < DSV_HP_PLANES; i++) {
+        if (hp[i] || !(phases & (1 << i))) {
+            continue;
+        }
+        hp[i] = dsv_mk_frame(ref->format, ref->width, ref->height, 1);
+        for (c = 0; c < nplanes; c++) {
+            hp_fill(ref->planes + c, hp[i]->planes + c, c, i + 1);
+        }
+    }
+}
+
+extern int
+dsv_hpel_phases(DSV_MV *vecs, DSV_PARAMS *p)
+{
+    int i, n, sh, sv, phases = 0;
+    DSV_MV *mv;
+    
+    sh = DSV_FORMAT_H_SHIFT(p->vidmeta->subsamp);
+    sv = DSV_FORMAT_V_SHIFT(p->vidmeta->subsamp);
+    n = p->nblocks_h * p->nblocks_v;
+    for (i = 0; i < n; i++) {
+        mv = &vecs[i];
+        if (mv->mode != DSV_MODE_INTER) {
+            continue;
+        }
+        /* luma and chroma vectors can land on different phases */
+        phases |= 1 << (((mv->u.mv.x & 1) << 1) | (mv->u.mv.y & 1));
+        phases |= 1 << ((((mv->u.mv.x >> sh) & 1) << 1) | ((mv->u.mv.y >> sv) & 1));
+    }
+    return phases >> 1; /* full-pel does not need a plane */
+}
+
+extern void
+dsv_hpel_planes_free(DSV_FRAME **hp)
+{
+    int i;
+    
+    for (i = 0; i < DSV_HP_PLANES; i++) {
+        if (hp[i]) {
+            dsv_frame_ref_dec(hp[i]);
+            hp[i] = NULL;
+        }
+    }
+}
+
 /* copy directly from previous reference block */
 static void
 cpyzero(uint8_t *dec, uint8_t *ref, int dw, int rw, int w, int h)
@@ -201,11 +777,30 @@ cpyzero(uint8_t *dec, uint8_t *ref, int dw, int rw, int w, int h)
     }
 }
 
+#define COMBINE_ADD 0 /* dp += xp */
+#define COMBINE_SUB 1 /* xp -= dp */
+
+/* combine an area of prediction dp with the residual / input xp */
+static void
+combine(int op, DSV_PLANE *dp, DSV_PLANE *xp, int x, int y, int w, int h)
+{
+    if (op == COMBINE_ADD) {
+        kern.addf(DSV_GET_XY(dp, x, y), dp->stride, DSV_GET_XY(xp, x, y), xp->stride, w, h);
+    } else {
+        kern.subf(DSV_GET_XY(xp, x, y), xp->stride, DSV_GET_XY(dp, x, y), dp->stride, w, h);
+    }
+}
+
+/* predict rows of blocks j0 up to j1 of plane c into dp, each row of
+ * blocks is combined with xp right after it is predicted while it is
+ * still in cache */
 static void
-compensate(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_FRAME *ref, DSV_PLANE *dp)
+compensate(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_FRAME *ref, DSV_FRAME **hp,
+        DSV_PLANE *dp, DSV_PLANE *xp, int op, int j0, int j1)
 {
     int i, j, r, x, y, dx, dy, px, py, bw, bh, cw, ch, sh, sv, limx, limy;
     DSV_PLANE *rp;
+    DSV_FRAME *hpf;
     DSV_MV *mv;
 
     if (c == 0) {
@@ -215,6 +810,9 @@ compensate(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_FRAME *ref, DSV_PLANE *dp)
         sh = DSV_FORMAT_H_SHIFT(p->vidmeta->subsamp);
         sv = DSV_FORMAT_V_SHIFT(p->vidmeta->subsamp);
     }
+    /* a smaller picture is treated like another level of subsampling */
+    sh += p->scale;
+    sv += p->scale;
     bw = p->blk_w >> sh;
     bh = p->blk_h >> sv;
     
@@ -223,7 +821,7 @@ compensate(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_FRAME *ref, DSV_PLANE *dp)
     
     rp = ref->planes + c;
     
-    for (j = 0; j < p->nblocks_v; j++) {
+    for (j = j0; j < j1; j++) {
         y = j * bh;
         ch = bh;
         if (y + bh >= dp->h) {
@@ -247,19 +845,34 @@ compensate(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_FRAME *ref, DSV_PLANE *dp)
                 py = y + (dy >> 1);
                 px = CLAMP(px, -DSV_FRAME_BORDER, limx);
                 py = CLAMP(py, -DSV_FRAME_BORDER, limy);
-                /* different hpel filter for luma */
-                (c == 0 ? hpelL : hpel)
-                       (DSV_GET_XY(dp, x, y),
-                        DSV_GET_XY(rp, px, py),
-                        dx & 1, dy & 1,
-                        dp->stride, rp->stride, cw, ch);
+                hpf = NULL;
+                if (hp && ((dx | dy) & 1) &&
+                        px >= -DSV_HP_BORDER && (px + cw) <= (dp->w + DSV_HP_BORDER) &&
+                        py >= -DSV_HP_BORDER && (py + ch) <= (dp->h + DSV_HP_BORDER)) {
+                    hpf = hp[(((dx & 1) << 1) | (dy & 1)) - 1];
+                }
+                if (hpf) {
+                    DSV_PLANE *hpp = hpf->planes + c;
+                    
+                    cpyzero(DSV_GET_XY(dp, x, y),
+                            DSV_GET_XY(hpp, px, py),
+                            dp->stride, hpp->stride, cw, ch);
+                } else {
+                    /* different hpel filter for luma */
+                    (c == 0 ? kern.hpelL[cw] : kern.hpel)
+                           (DSV_GET_XY(dp, x, y),
+                            DSV_GET_XY(rp, px, py),
+                            dx & 1, dy & 1,
+                            dp->stride, rp->stride, cw, ch);
+                }
             } else { /* intra */
                 /* D.2 Compensating Intra Blocks */
                 uint8_t *dec;
                 int avgc;
                 
-                if (mv->submask == DSV_MASK_ALL_INTRA) {
-                    avgc = avgval(DSV_GET_XY(rp, x, y), rp->stride, cw, ch);
+                /* sub-blocks can be less than a pixel at a smaller scale */
+                if (mv->submask == DSV_MASK_ALL_INTRA || cw < 2 || ch < 2) {
+                    avgc = kern.avgval[cw](DSV_GET_XY(rp, x, y), rp->stride, cw, ch);
                     dec = DSV_GET_XY(dp, x, y);
                     for (r = 0; r < ch; r++) {
                         memset(dec, avgc, cw);
@@ -281,7 +894,7 @@ compensate(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_FRAME *ref, DSV_PLANE *dp)
                             sbx = x + f;
                             sby = y + g;
                             if (mv->submask & masks[mask_index]) {
-                                avgc = avgval(DSV_GET_XY(rp, sbx, sby), rp->stride, sbw, sbh);
+                                avgc = kern.avgval[sbw](DSV_GET_XY(rp, sbx, sby), rp->stride, sbw, sbh);
                                 dec = DSV_GET_XY(dp, sbx, sby);
                                 for (r = 0; r < sbh; r++) {
                                     memset(dec, avgc, sbw);
@@ -298,6 +911,12 @@ compensate(DSV_MV *vecs, DSV_PARAMS *p, int c, DSV_FRAME *ref, DSV_PLANE *dp)
                 }
             }
         }
+        combine(op, dp, xp, 0, y, dp->w, ch);
+    }
+    /* whatever no block covers */
+    if (j1 == p->nblocks_v) {
+        y = MIN(p->nblocks_v * bh, dp->h);
+        combine(op, dp, xp, 0, y, dp->w, dp->h - y);
     }
 }
 
@@ -307,40 +926,73 @@ dsv_frame_add(DSV_FRAME *dst, DSV_FRAME *src)
     DSV_PLANE *s, *d;
     int c;
     
+    kern_init();
     for (c = 0; c < 3; c++) {
         s = src->planes + c;
         d = dst->planes + c;
         
-        addf(d->data, d->stride, s->data, s->stride, d->w, d->h);
+        kern.addf(d->data, d->stride, s->data, s->stride, d->w, d->h);
     }
 }
 
 extern void
-dsv_sub_pred(DSV_MV *mv, DSV_PARAMS *p, DSV_FRAME *dif, DSV_FRAME *inp, DSV_FRAME *ref)
+dsv_sub_pred(DSV_MV *mv, DSV_PARAMS *p, DSV_FRAME *dif, DSV_FRAME *inp, DSV_FRAME *ref, DSV_FRAME **hp)
 {
     DSV_PLANE *d, *i;
     int c;
 
+    kern_init();
     for (c = 0; c < 3; c++) {
         d = dif->planes + c;
         i = inp->planes + c;
         
-        compensate(mv, p, c, ref, d);
-        subf(i->data, i->stride, d->data, d->stride, d->w, d->h);
+        compensate(mv, p, c, ref, hp, d, i, COMBINE_SUB, 0, p->nblocks_v);
     }
 }
 
-extern void
-dsv_add_pred(DSV_MV *mv, DSV_PARAMS *p, DSV_FRAME *dif, DSV_FRAME *out, DSV_FRAME *ref)
-{
-    DSV_PLANE *d, *o;
-    int c;
+struct MC_JOB {
+    DSV_MV *vecs;
+    DSV_PARAMS *p;
+    DSV_FRAME *dif;
+    DSV_FRAME *out;
+    DSV_FRAME *ref;
+    DSV_FRAME **hp;
+    int nthreads;
+};
 
+/* every block only depends on the reference and its own vector, so each
+ * thread can take its own range of block rows */
+static void
+add_pred_rows(void *arg, int idx)
+{
+    struct MC_JOB *job = arg;
+    int c, j0, j1, nbv;
+    
+    nbv = job->p->nblocks_v;
+    j0 = nbv * idx / job->nthreads;
+    j1 = nbv * (idx + 1) / job->nthreads;
     for (c = 0; c < 3; c++) {
-        d = dif->planes + c;
-        o = out->planes + c;
-        
-        compensate(mv, p, c, ref, o);
-        addf(o->data, o->stride, d->data, d->stride, o->w, o->h);
+        compensate(job->vecs, job->p, c, job->ref, job->hp,
+                job->out->planes + c, job->dif->planes + c, COMBINE_ADD, j0, j1);
+    }
+}
+
+extern void
+dsv_add_pred(DSV_MV *mv, DSV_PARAMS *p, DSV_FRAME *dif, DSV_FRAME *out, DSV_FRAME *ref, DSV_FRAME **hp, int nthreads)
+{
+    struct MC_JOB job;
+    
+    kern_init();
+    job.vecs = mv;
+    job.p = p;
+    job.dif = dif;
+    job.out = out;
+    job.ref = ref;
+    job.hp = hp;
+    job.nthreads = CLAMP(nthreads, 1, p->nblocks_v);
+    if (job.nthreads == 1) {
+        add_pred_rows(&job, 0);
+    } else {
+        dsv_parallel(job.nthreads, add_pred_rows, &job);
     }
 }
@@ -18,12 +18,16 @@ pub fn build(b: *std.Build) void {
             "dsv.c",
             "dsv_decoder.c",
             "dsv_encoder.c",
+            "dsv_index.c",
             "dsv_main.c",
             "frame.c",
             "hme.c",
             "hzcc.c",
+            "platform.c",
             "sbt.c",
+            "synth.c",
             "util.c",
+            "yuv.c",
         },
         .flags = &.{
             "-std=c99",
@@ -34,4 +38,33 @@ pub fn build(b: *std.Build) void {
     // Link libc
     bin.linkLibC();
     b.installArtifact(bin);
+
+    // Kernel microbenchmarks, only built by `zig build kbench`
+    const kbench = b.addExecutable(.{
+        .name = "kbench",
+        .target = target,
+        .optimize = .ReleaseFast,
+    });
+
+    kbench.addCSourceFiles(.{
+        .files = &.{
+            "bench/k_bmc.c",
+            "bench/k_hme.c",
+            "bench/k_hzcc.c",
+            "bench/k_sbt.c",
+            "bench/kbench.c",
+            "bs.c",
+            "dsv.c",
+            "frame.c",
+            "platform.c",
+        },
+        .flags = &.{
+            "-std=c99",
+            "-O3",
+        },
+    });
+
+    kbench.linkLibC();
+    const kbench_step = b.step("kbench", "Build the kernel microbenchmarks");
+    kbench_step.dependOn(&b.addInstallArtifact(kbench, .{}).step);
 }
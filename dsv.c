@@ -15,6 +15,7 @@
 /*****************************************************************************/
 
 #include "dsv_internal.h"
+#include "platform.h"
 
 char *dsv_lvlname[DSV_LEVEL_DEBUG + 1] = {
     "NONE",
@@ -38,21 +39,54 @@ dsv_get_log_level(void)
     return lvl;
 }
 
+static char *mem_tag_names[DSV_MEM_NTAGS + 1] = {
+    "other", "frame", "coefs", "motion", "bits", "scratch", "total"
+};
+
 #if DSV_MEMORY_STATS
-static unsigned allocated = 0;
-static unsigned freed = 0;
-static unsigned allocated_bytes = 0;
-static unsigned freed_bytes = 0;
+/* the last entry is the total over all tags */
+static DSV_MEMUSE memuse[DSV_MEM_NTAGS + 1];
+
+/* must hold the global lock */
+static void
+mem_add(int tag, unsigned long size)
+{
+    DSV_MEMUSE *u = &memuse[tag];
+    DSV_MEMUSE *t = &memuse[DSV_MEM_NTAGS];
+    int i;
+    
+    u->allocs++;
+    u->cur += size;
+    u->peak = MAX(u->peak, u->cur);
+    u->frame_peak = MAX(u->frame_peak, u->cur);
+    t->allocs++;
+    t->cur += size;
+    t->frame_peak = MAX(t->frame_peak, t->cur);
+    if (t->cur > t->peak) {
+        t->peak = t->cur;
+        for (i = 0; i <= DSV_MEM_NTAGS; i++) {
+            memuse[i].at_peak = memuse[i].cur;
+        }
+    }
+}
 
 extern void *
-dsv_alloc(int size)
+dsv_alloc_tag(int size, int tag)
 {
     void *p;
 
+    if (tag < 0 || tag >= DSV_MEM_NTAGS) {
+        tag = DSV_MEM_OTHER;
+    }
     p = calloc(1, size + 16);
-    *((int32_t *) p) = size;
-    allocated++;
-    allocated_bytes += size;
+    if (p == NULL) {
+        return NULL;
+    }
+    ((int32_t *) p)[0] = size;
+    ((int32_t *) p)[1] = tag;
+    dsv_global_lock();
+    mem_add(tag, size);
+    dsv_global_unlock();
     return (uint8_t *) p + 16;
 }
 
@@ -60,25 +94,60 @@ extern void
 dsv_free(void *ptr)
 {
     uint8_t *p;
-    freed++;
+    int32_t size, tag;
+
     p = ((uint8_t *) ptr) - 16;
-    freed_bytes += *((int32_t *) p);
+    size = ((int32_t *) p)[0];
+    tag = ((int32_t *) p)[1];
+    dsv_global_lock();
+    memuse[tag].frees++;
+    memuse[tag].cur -= size;
+    memuse[DSV_MEM_NTAGS].frees++;
+    memuse[DSV_MEM_NTAGS].cur -= size;
+    dsv_global_unlock();
     free(p);
 }
 
+extern void
+dsv_memory_usage(DSV_MEMUSE *u)
+{
+    dsv_global_lock();
+    memcpy(u, memuse, sizeof(memuse));
+    dsv_global_unlock();
+}
+
+extern void
+dsv_memory_frame(void)
+{
+    int i;
+    
+    dsv_global_lock();
+    for (i = 0; i <= DSV_MEM_NTAGS; i++) {
+        memuse[i].frame_peak = memuse[i].cur;
+    }
+    dsv_global_unlock();
+}
+
 extern void
 dsv_memory_report(void)
 {
-    DSV_DEBUG(("n alloc: %u", allocated));
-    DSV_DEBUG(("n freed: %u", freed));
-    DSV_DEBUG(("alloc bytes: %u", allocated_bytes));
-    DSV_DEBUG(("freed bytes: %u", freed_bytes));
-    DSV_DEBUG(("bytes not freed: %d", allocated_bytes - freed_bytes));
+    DSV_MEMUSE *u;
+    int i;
+    
+    for (i = 0; i <= DSV_MEM_NTAGS; i++) {
+        u = &memuse[i];
+        if (u->allocs == 0) {
+            continue;
+        }
+        DSV_DEBUG(("%-7s n alloc: %lu n freed: %lu peak bytes: %lu (%lu at total peak) bytes not freed: %lu",
+                mem_tag_names[i], u->allocs, u->frees, u->peak, u->at_peak, u->cur));
+    }
 }
 #else
 extern void *
-dsv_alloc(int size)
+dsv_alloc_tag(int size, int tag)
 {
+    (void) tag;
     return calloc(1, size);
 }
 
@@ -88,6 +157,17 @@ dsv_free(void *ptr)
     free(ptr);
 }
 
+extern void
+dsv_memory_usage(DSV_MEMUSE *u)
+{
+    memset(u, 0, sizeof(*u) * (DSV_MEM_NTAGS + 1));
+}
+
+extern void
+dsv_memory_frame(void)
+{
+}
+
 extern void
 dsv_memory_report(void)
 {
@@ -95,6 +175,21 @@ dsv_memory_report(void)
 }
 #endif
 
+extern void *
+dsv_alloc(int size)
+{
+    return dsv_alloc_tag(size, DSV_MEM_OTHER);
+}
+
+extern char *
+dsv_memory_tag_name(int tag)
+{
+    if (tag < 0 || tag > DSV_MEM_NTAGS) {
+        return "unknown";
+    }
+    return mem_tag_names[tag];
+}
+
 extern int
 dsv_yuv_write(FILE *out, int fno, DSV_PLANE *p)
 {
@@ -182,10 +277,138 @@ extern void
 dsv_mk_buf(DSV_BUF *buf, int size)
 {
     memset(buf, 0, sizeof(*buf));
-    buf->data = dsv_alloc(size);
+    buf->data = dsv_alloc_tag(size, DSV_MEM_BITS);
     buf->len = size;
 }
 
+/* B.1 Packet Header Link Offsets */
+extern void
+dsv_set_prev_link(uint8_t *packet, unsigned link)
+{
+    packet[DSV_PACKET_PREV_OFFSET + 0] = (link >> 24) & 0xff;
+    packet[DSV_PACKET_PREV_OFFSET + 1] = (link >> 16) & 0xff;
+    packet[DSV_PACKET_PREV_OFFSET + 2] = (link >>  8) & 0xff;
+    packet[DSV_PACKET_PREV_OFFSET + 3] = (link >>  0) & 0xff;
+}
+
+extern unsigned long
+dsv_timer_start(DSV_STATS *t)
+{
+    if (t == NULL || !t->enabled) {
+        return 0;
+    }
+    return dsv_usec();
+}
+
+extern void
+dsv_timer_stop(DSV_STATS *t, int stage, unsigned long start)
+{
+    if (t == NULL || !t->enabled) {
+        return;
+    }
+    t->usec[stage] += dsv_usec() - start;
+    t->calls[stage]++;
+}
+
+/* 0..7 are exact, above that 8 buckets for every power of two */
+static int
+latency_bucket(unsigned long usec)
+{
+    int b = 0;
+    
+    if (usec < 8) {
+        return usec;
+    }
+    while ((usec >> b) >= 16) {
+        b++;
+    }
+    return MIN((b + 1) * 8 + ((usec >> b) & 7), DSV_LAT_BUCKETS - 1);
+}
+
+/* largest latency that falls into a bucket */
+static unsigned long
+bucket_max(int i)
+{
+    int b;
+    
+    if (i < 8) {
+        return i;
+    }
+    b = i / 8 - 1;
+    return ((unsigned long) (8 + (i & 7) + 1) << b) - 1;
+}
+
+extern void
+dsv_stats_frame(DSV_STATS *t, unsigned long start)
+{
+    unsigned long usec;
+    
+    if (t == NULL) {
+        return;
+    }
+    t->frames++;
+    if (!t->enabled) {
+        return;
+    }
+    usec = dsv_usec() - start;
+    t->latency[latency_bucket(usec)]++;
+    if (usec > t->latency_max) {
+        t->latency_max = usec;
+    }
+}
+
+extern unsigned long
+dsv_stats_latency(DSV_STATS *t, int pct)
+{
+    unsigned long n = 0, want, sum = 0;
+    int i;
+    
+    for (i = 0; i < DSV_LAT_BUCKETS; i++) {
+        n += t->latency[i];
+    }
+    if (n == 0) {
+        return 0;
+    }
+    want = (n * pct + 99) / 100;
+    for (i = 0; i < DSV_LAT_BUCKETS; i++) {
+        sum += t->latency[i];
+        if (sum >= want && sum > 0) {
+            return MIN(bucket_max(i), t->latency_max);
+        }
+    }
+    return t->latency_max;
+}
+
+extern void
+dsv_stats_add(DSV_STATS *dst, DSV_STATS *src)
+{
+    int i;
+    
+    for (i = 0; i < DSV_NUM_STAGES; i++) {
+        dst->usec[i] += src->usec[i];
+        dst->calls[i] += src->calls[i];
+    }
+    for (i = 0; i < DSV_LAT_BUCKETS; i++) {
+        dst->latency[i] += src->latency[i];
+    }
+    for (i = 0; i < 3; i++) {
+        dst->plane_bytes[i] += src->plane_bytes[i];
+    }
+    dst->enabled |= src->enabled;
+    dst->frames += src->frames;
+    dst->latency_max = MAX(dst->latency_max, src->latency_max);
+    dst->hdr_bytes += src->hdr_bytes;
+    dst->blocks += src->blocks;
+    dst->intra_blocks += src->intra_blocks;
+    dst->hpel_searched += src->hpel_searched;
+    dst->hpel_skipped += src->hpel_skipped;
+    dst->hpel_hits += src->hpel_hits;
+    dst->static_blocks += src->static_blocks;
+    dst->deadline_misses += src->deadline_misses;
+    dst->effort_drops += src->effort_drops;
+    dst->effort_raises += src->effort_raises;
+}
+
 static int
 pred(int left, int top, int topleft) 
 {
@@ -125,6 +125,10 @@ typedef struct {
     int border;
 } DSV_FRAME;
 
+/* # of half-pel interpolated copies of a reference frame,
+ * indexed by ((x_half << 1) | y_half) - 1. i.e V, H, HV */
+#define DSV_HP_PLANES 3
+
 /* B.2.3.2 Motion Data - Intra Sub-Block Masks */
 #define DSV_MODE_INTER   0 /* whole block is inter */
 #define DSV_MODE_INTRA   1 /* some or all of the block is intra */
@@ -170,6 +174,8 @@ extern void dsv_frame_add(DSV_FRAME *dst, DSV_FRAME *src);
 extern int dsv_frame_avg_luma(DSV_FRAME *frame);
 
 extern void dsv_ds2x_frame_luma(DSV_FRAME *dest, DSV_FRAME *src);
+/* src must have a border if any of its chroma dimensions are odd */
+extern void dsv_ds2x_frame_chroma(DSV_FRAME *dest, DSV_FRAME *src);
 
 extern DSV_FRAME *dsv_clone_frame(DSV_FRAME *f, int border);
 extern DSV_FRAME *dsv_extend_frame(DSV_FRAME *frame);
@@ -190,6 +196,9 @@ typedef struct {
     /* number of blocks horizontally and vertically in the image */
     int nblocks_h;
     int nblocks_v;
+    /* decoder only, the picture is reconstructed at 1 / (1 << scale) of
+     * its coded size, see DSV_DECODER scale */
+    int scale;
 } DSV_PARAMS;
 
 typedef struct {
@@ -199,6 +208,70 @@ typedef struct {
 
 extern void dsv_mk_buf(DSV_BUF *buf, int size);
 extern void dsv_buf_free(DSV_BUF *buffer);
+/* overwrite the previous link offset of an encoded packet, used when
+ * splicing together streams that were encoded separately */
+extern void dsv_set_prev_link(uint8_t *packet, unsigned link);
+
+/* Statistics
+ *
+ * optional accounting of where an encoder or decoder spends its time and
+ * bits. Everything is a running total since the encoder / decoder was
+ * initialized so it can be polled at any time. The counters are always
+ * kept, nothing is timed unless 'enabled' is set by the user.
+ */
+#define DSV_STAGE_PYRAMID 0 /* building the downscaled pyramid */
+#define DSV_STAGE_HME     1 /* motion estimation */
+#define DSV_STAGE_MC      2 /* motion compensation */
+#define DSV_STAGE_FWD_SBT 3 /* forward subband transform */
+#define DSV_STAGE_INV_SBT 4 /* inverse subband transform */
+#define DSV_STAGE_HZCC    5 /* coefficient coding */
+#define DSV_STAGE_STAB    6 /* stability block coding */
+#define DSV_STAGE_MOTION  7 /* motion vector / intra block coding */
+#define DSV_STAGE_BITS    8 /* everything else in a packet */
+#define DSV_STAGE_IO      9 /* up to the user, time spent reading / writing */
+#define DSV_NUM_STAGES    10
+
+/* frame latencies are kept as a histogram with 8 buckets per power of two
+ * so percentiles are accurate to within 1/8th */
+#define DSV_LAT_BUCKETS 256
+
+typedef struct {
+    int enabled;
+    unsigned long usec[DSV_NUM_STAGES];
+    unsigned long calls[DSV_NUM_STAGES];
+    
+    unsigned long frames; /* # of pictures coded */
+    unsigned long latency[DSV_LAT_BUCKETS]; /* only when enabled */
+    unsigned long latency_max; /* usec */
+    unsigned long plane_bytes[3]; /* size of the coded planes */
+    unsigned long hdr_bytes; /* the rest of the picture packets */
+    unsigned long blocks; /* # of blocks in inter frames */
+    unsigned long intra_blocks; /* # of those that were intra */
+    /* encoder only, full-pel blocks that got a half-pel search, ones that
+     * were found to have too little detail to bother, and searches that
+     * found a better half-pel vector */
+    unsigned long hpel_searched;
+    unsigned long hpel_skipped;
+    unsigned long hpel_hits;
+    /* encoder only, blocks that were (nearly) unchanged from the reference
+     * and got the zero vector without being searched or analyzed */
+    unsigned long static_blocks;
+    /* encoder only, with a deadline set: pictures that took longer than
+     * it, and how many times the effort was lowered / raised because of it */
+    unsigned long deadline_misses;
+    unsigned long effort_drops;
+    unsigned long effort_raises;
+} DSV_STATS;
+
+/* returns the value to pass as 'start' to dsv_timer_stop */
+extern unsigned long dsv_timer_start(DSV_STATS *t);
+extern void dsv_timer_stop(DSV_STATS *t, int stage, unsigned long start);
+/* count a coded picture that was started at 'start' (from dsv_timer_start) */
+extern void dsv_stats_frame(DSV_STATS *t, unsigned long start);
+/* latency in usec that pct percent of the timed pictures came in under */
+extern unsigned long dsv_stats_latency(DSV_STATS *t, int pct);
+/* add the counts in src to dst, to combine several encoders or decoders */
+extern void dsv_stats_add(DSV_STATS *dst, DSV_STATS *src);
 
 extern int dsv_yuv_write(FILE *out, int fno, DSV_PLANE *fd);
 extern int dsv_yuv_read(FILE *in, int fno, uint8_t *o, int w, int h, int subsamp);
@@ -207,9 +280,36 @@ extern int dsv_yuv_read(FILE *in, int fno, uint8_t *o, int w, int h, int subsamp
 #define DSV_MEMORY_STATS 1
 #endif
 
+/* what an allocation is used for, for memory accounting */
+#define DSV_MEM_OTHER   0 /* structs, stability data, anything not below */
+#define DSV_MEM_FRAME   1 /* frame / plane data */
+#define DSV_MEM_COEFS   2 /* subband coefficients */
+#define DSV_MEM_MOTION  3 /* motion vector fields */
+#define DSV_MEM_BITS    4 /* bitstream buffers */
+#define DSV_MEM_SCRATCH 5 /* short lived temporary buffers */
+#define DSV_MEM_NTAGS   6
+
+/* same as dsv_alloc_tag(size, DSV_MEM_OTHER) */
 extern void *dsv_alloc(int size);
+extern void *dsv_alloc_tag(int size, int tag);
 extern void dsv_free(void *ptr);
 
+typedef struct {
+    unsigned long allocs; /* # of allocations made */
+    unsigned long frees;
+    unsigned long cur; /* bytes in use right now */
+    unsigned long peak; /* most bytes that were ever in use at once */
+    unsigned long frame_peak; /* most in use since the last dsv_memory_frame */
+    unsigned long at_peak; /* bytes in use when the total use peaked */
+} DSV_MEMUSE;
+
+/* fills in u[0...DSV_MEM_NTAGS - 1] for each tag and u[DSV_MEM_NTAGS] for
+ * all of them together. process wide, all zero if DSV_MEMORY_STATS is 0 */
+extern void dsv_memory_usage(DSV_MEMUSE *u);
+/* start over the frame_peak high-water marks */
+extern void dsv_memory_frame(void);
+/* DSV_MEM_NTAGS gives "total" */
+extern char *dsv_memory_tag_name(int tag);
 extern void dsv_memory_report(void);
 
 #define DSV_LEVEL_NONE    0
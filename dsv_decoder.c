@@ -16,6 +16,7 @@
 
 #include "dsv_decoder.h"
 #include "dsv_internal.h"
+#include "platform.h"
 
 /* B.1 Packet Header */
 static int
@@ -49,10 +50,8 @@ decode_packet_hdr(DSV_BS *bs)
 
 /* B.2.1 Metadata Packet */
 static void
-decode_meta(DSV_DECODER *d, DSV_BS *bs)
+decode_meta(DSV_META *fmt, DSV_BS *bs)
 {
-    DSV_META *fmt = &d->vidmeta;
-        
     fmt->width = dsv_bs_get_ueg(bs);
     fmt->height = dsv_bs_get_ueg(bs);
     DSV_DEBUG(("dimensions = %d x %d", fmt->width, fmt->height));
@@ -190,8 +189,8 @@ draw_info(DSV_IMAGE *img, DSV_FRAME *output_pic, DSV_MV *mvs, int mode)
     DSV_PARAMS *p = &img->params;
     
     lp = output_pic->planes + 0; /* luma plane */
-    bw = p->blk_w;
-    bh = p->blk_h;
+    bw = p->blk_w >> p->scale;
+    bh = p->blk_h >> p->scale;
     for (j = 0; j < p->nblocks_v; j++) {
         y = j * bh;
         memset(DSV_GET_LINE(lp, y), 0, lp->stride);
@@ -213,7 +212,7 @@ draw_info(DSV_IMAGE *img, DSV_FRAME *output_pic, DSV_MV *mvs, int mode)
                 }
             }
             if ((mode & DSV_DRAW_MOVECS) && mv->mode == DSV_MODE_INTER) {
-                drawvec(lp, x, y, mv->u.mv.x, mv->u.mv.y, bw, bh);
+                drawvec(lp, x, y, mv->u.mv.x >> p->scale, mv->u.mv.y >> p->scale, bw, bh);
             }
             if ((mode & DSV_DRAW_IBLOCK) && mv->mode == DSV_MODE_INTRA) {
                 if (mv->submask & DSV_MASK_INTRA00) {
@@ -261,90 +260,118 @@ img_unref(DSV_IMAGE *img)
     if (img->ref_frame) {
         dsv_frame_ref_dec(img->ref_frame);
     }
+    dsv_hpel_planes_free(img->ref_hp);
     dsv_free(img);
 }
 
-extern void
-dsv_dec_free(DSV_DECODER *d)
-{
-    if (d->ref) {
-        img_unref(d->ref);
-    }
-}
-
-extern DSV_META *
-dsv_get_metadata(DSV_DECODER *d)
-{
-    DSV_META *meta;
-    
-    meta = dsv_alloc(sizeof(DSV_META));
-    memcpy(meta, &d->vidmeta, sizeof(DSV_META));
-    
-    return meta;
-}
-
-extern int
-dsv_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
+/* Decoding a picture is done in two halves. decode_packet parses a packet
+ * and entropy decodes and inverse transforms its residual, none of which
+ * depends on earlier pictures. reconstruct then motion compensates the
+ * residual from the reference and keeps the result as the next reference.
+ * With DSV_DECODER pipeline set, decode_packet runs on its own thread up
+ * to 'pipeline' packets ahead of reconstruct.
+ */
+struct DEC_JOB {
+    DSV_BUF buf; /* the packet, freed once it has been decoded */
+    int code; /* what dsv_dec returns for it */
+    DSV_META meta; /* when code is DSV_DEC_GOT_META */
+    /* only set for a picture to reconstruct */
+    DSV_IMAGE *img;
+    DSV_FRAME *residual;
+    DSV_MV *mvs;
+    DSV_FNUM fno;
+    int is_ref;
+    int scale; /* DSV_DECODER scale when it was queued */
+    unsigned long start;
+    DSV_STATS stats; /* decoding it, added to the decoder's by reconstruct */
+};
+
+struct DSV_DEC_PIPE {
+    DSV_THREAD *thread;
+    DSV_MUTEX *lock;
+    DSV_COND *cond;
+    struct DEC_JOB *jobs; /* ring of depth + 1 */
+    int depth;
+    long nqueued; /* total packets queued */
+    long ndecoded; /* total decoded by the thread */
+    long nretired; /* total reconstructed and returned */
+    int stop;
+    /* metadata as of the last packet the thread parsed */
+    DSV_META meta;
+    int got_metadata;
+};
+
+/* meta and got_meta are the metadata state of the stream up to here */
+static void
+decode_packet(DSV_META *meta, int *got_meta, struct DEC_JOB *job)
 {
     DSV_BS bs;
     DSV_IMAGE *img;
     DSV_PARAMS *p;
-    int c, quant, is_ref, pkt_type, subsamp;
-    DSV_META *meta = &d->vidmeta;
+    DSV_BUF *buffer = &job->buf;
+    DSV_STATS *stats = &job->stats;
+    int c, quant, pkt_type, subsamp;
     DSV_FRAME *residual;
-    DSV_MV *mvs = NULL;
-    DSV_FNUM fno;
     DSV_STABILITY stab;
+    unsigned long t;
+    unsigned coded = 0; /* bytes of plane data */
 
-    *fn = -1;
+    job->start = dsv_timer_start(stats);
+    job->code = DSV_DEC_ERROR;
     
     dsv_bs_init(&bs, buffer->data);
     pkt_type = decode_packet_hdr(&bs);
     
     if (pkt_type == -1) {
         dsv_buf_free(buffer);
-        return DSV_DEC_ERROR;
+        return;
     }
     
     if (!DSV_PT_IS_PIC(pkt_type)) {
-        int ret = DSV_DEC_ERROR;
         switch (pkt_type) {
             case DSV_PT_META:
                 DSV_DEBUG(("decoding metadata"));
-                decode_meta(d, &bs);
-                d->got_metadata = 1;
-                ret = DSV_DEC_GOT_META;
+                decode_meta(meta, &bs);
+                *got_meta = 1;
+                job->meta = *meta;
+                job->code = DSV_DEC_GOT_META;
                 break;
             case DSV_PT_EOS:
                 DSV_DEBUG(("decoding end of stream"));
-                ret = DSV_DEC_EOS;
+                job->code = DSV_DEC_EOS;
                 break;
         }
         dsv_buf_free(buffer);
-        return ret;
+        return;
     }
 
-    if (!d->got_metadata) {
+    if (!*got_meta) {
         DSV_WARNING(("no metadata, skipping frame"));
         dsv_buf_free(buffer);
-        return DSV_DEC_OK;
+        job->code = DSV_DEC_OK;
+        return;
     }
 
     img = dsv_alloc(sizeof(DSV_IMAGE));
     img->refcount = 1;
-        
-    img->params.vidmeta = meta;
+    
+    /* its own copy, the stream's may change while it is still in use */
+    img->meta = *meta;
+    img->params.vidmeta = &img->meta;
+    meta = &img->meta;
     
     subsamp = meta->subsamp;
         
     p = &img->params;
     
     p->has_ref = DSV_PT_HAS_REF(pkt_type);
-    is_ref = DSV_PT_IS_REF(pkt_type);
+    p->scale = CLAMP(job->scale, 0, DSV_MAX_SCALE);
+    job->is_ref = DSV_PT_IS_REF(pkt_type);
     
+    t = dsv_timer_start(stats);
     dsv_bs_align(&bs);
     
-    fno = dsv_bs_get_bits(&bs, 32);
+    job->fno = dsv_bs_get_bits(&bs, 32);
     
     dsv_bs_align(&bs);
     
@@ -353,19 +380,35 @@ dsv_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
 
     if (p->blk_w < DSV_MIN_BLOCK_SIZE || p->blk_h < DSV_MIN_BLOCK_SIZE || 
         p->blk_w > DSV_MAX_BLOCK_SIZE || p->blk_h > DSV_MAX_BLOCK_SIZE) {
+        dsv_timer_stop(stats, DSV_STAGE_BITS, t);
         dsv_buf_free(buffer);
-        return DSV_DEC_ERROR;
+        img_unref(img);
+        return;
     }
     p->nblocks_h = DSV_DIV_ROUND(meta->width, p->blk_w);
     p->nblocks_v = DSV_DIV_ROUND(meta->height, p->blk_h);
 
+    dsv_timer_stop(stats, DSV_STAGE_BITS, t);
+
     img->stable_blocks = dsv_alloc(p->nblocks_h * p->nblocks_v);
+    t = dsv_timer_start(stats);
     decode_stability_blocks(img, &bs, buffer);
+    dsv_timer_stop(stats, DSV_STAGE_STAB, t);
     if (p->has_ref) {
-        mvs = dsv_alloc(sizeof(DSV_MV) * p->nblocks_h * p->nblocks_v);
-        decode_motion(img, mvs, &bs, buffer);
+        int i, nblk = p->nblocks_h * p->nblocks_v;
+        
+        job->mvs = dsv_alloc_tag(sizeof(DSV_MV) * nblk, DSV_MEM_MOTION);
+        t = dsv_timer_start(stats);
+        decode_motion(img, job->mvs, &bs, buffer);
+        dsv_timer_stop(stats, DSV_STAGE_MOTION, t);
+        for (i = 0; i < nblk; i++) {
+            stats->intra_blocks += (job->mvs[i].mode == DSV_MODE_INTRA);
+        }
+        stats->blocks += nblk;
     }
-    residual = dsv_mk_frame(subsamp, meta->width, meta->height, 1);
+    residual = dsv_mk_frame(subsamp,
+            DSV_ROUND_SHIFT(meta->width, p->scale),
+            DSV_ROUND_SHIFT(meta->height, p->scale), 1);
     
     /* B.2.3.3 Image Data */
     dsv_bs_align(&bs);
@@ -386,12 +429,13 @@ dsv_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
         plen = dsv_bs_get_bits(&bs, 32);
         
         dsv_bs_align(&bs);
+        /* the coefficients are always for the full size plane */
         if (c > 0) {
-            coefs.width = DSV_ROUND_POW2(residual->planes[c].w, 1);
-            coefs.height = DSV_ROUND_POW2(residual->planes[c].h, 1);
+            coefs.width = DSV_ROUND_POW2(DSV_ROUND_SHIFT(meta->width, DSV_FORMAT_H_SHIFT(subsamp)), 1);
+            coefs.height = DSV_ROUND_POW2(DSV_ROUND_SHIFT(meta->height, DSV_FORMAT_V_SHIFT(subsamp)), 1);
         } else {
-            coefs.width = residual->planes[c].w;
-            coefs.height = residual->planes[c].h;
+            coefs.width = meta->width;
+            coefs.height = meta->height;
         }
 
         framesz = coefs.width * coefs.height * sizeof(int);        
@@ -401,53 +445,119 @@ dsv_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
         }
         encoded_buf = buffer->data + dsv_bs_ptr(&bs);
         dsv_bs_skip(&bs, plen);
+        stats->plane_bytes[c] += plen;
+        coded += plen;
     
-        coefs.data = dsv_alloc(framesz);
+        coefs.data = dsv_alloc_tag(framesz, DSV_MEM_COEFS);
         stab.cur_plane = c;
+        t = dsv_timer_start(stats);
         dsv_decode_plane(encoded_buf, plen, &coefs, quant, &stab);
-        dsv_inv_sbt(&residual->planes[c], &coefs, quant, stab.isP, c);
+        dsv_timer_stop(stats, DSV_STAGE_HZCC, t);
+        
+        t = dsv_timer_start(stats);
+        dsv_inv_sbt(&residual->planes[c], &coefs, quant, stab.isP, c, p->scale);
+        dsv_timer_stop(stats, DSV_STAGE_INV_SBT, t);
         if (coefs.data) {
             dsv_free(coefs.data);
         }
     }
 
-    *fn = fno;
+    stats->hdr_bytes += buffer->len - coded;
+    dsv_buf_free(buffer);
+    
+    job->img = img;
+    job->residual = residual;
+    job->code = DSV_DEC_OK;
+}
+
+/* release a decoded packet that will not be reconstructed */
+static void
+job_free(struct DEC_JOB *job)
+{
+    if (job->img) {
+        img_unref(job->img);
+        job->img = NULL;
+    }
+    if (job->residual) {
+        dsv_frame_ref_dec(job->residual);
+        job->residual = NULL;
+    }
+    if (job->mvs) {
+        dsv_free(job->mvs);
+        job->mvs = NULL;
+    }
+}
+
+static int
+reconstruct(DSV_DECODER *d, struct DEC_JOB *job, DSV_FRAME **out, DSV_FNUM *fn)
+{
+    DSV_IMAGE *img = job->img;
+    DSV_PARAMS *p;
+    DSV_META *meta;
+    unsigned long t;
+
+    dsv_stats_add(&d->stats, &job->stats);
+    if (job->code == DSV_DEC_GOT_META) {
+        d->vidmeta = job->meta;
+        d->got_metadata = 1;
+    }
+    if (img == NULL) {
+        return job->code;
+    }
+    p = &img->params;
+    meta = p->vidmeta;
+    
+    if (p->has_ref && d->ref == NULL) {
+        DSV_WARNING(("reference frame not found"));
+        job_free(job);
+        return DSV_DEC_ERROR;
+    }
+    if (p->has_ref && d->ref->params.scale != p->scale) {
+        DSV_WARNING(("scale changed since the reference frame"));
+        job_free(job);
+        return DSV_DEC_ERROR;
+    }
+    *fn = job->fno;
 
     img->refcount++;
 
     if (!img->out_frame) {
-        img->out_frame = dsv_mk_frame(subsamp, meta->width, meta->height, 1);
+        img->out_frame = dsv_mk_frame(meta->subsamp,
+                DSV_ROUND_SHIFT(meta->width, p->scale),
+                DSV_ROUND_SHIFT(meta->height, p->scale), 1);
     }
 
     if (p->has_ref) {
         DSV_IMAGE *ref = d->ref;
-        if (ref == NULL) {
-            DSV_WARNING(("reference frame not found"));
-            return DSV_DEC_ERROR;
-        }
 
 #if 0 /* SHOW RESIDUAL */
-        dsv_frame_copy(img->out_frame, residual);
+        dsv_frame_copy(img->out_frame, job->residual);
 #else
-        dsv_add_pred(mvs, p, residual, img->out_frame, ref->ref_frame);
+        t = dsv_timer_start(&d->stats);
+        if (d->hpel_planes) {
+            dsv_hpel_planes(ref->ref_frame, ref->ref_hp, 3, dsv_hpel_phases(job->mvs, p));
+        }
+        dsv_add_pred(job->mvs, p, job->residual, img->out_frame, ref->ref_frame,
+                d->hpel_planes ? ref->ref_hp : NULL, d->threads);
+        dsv_timer_stop(&d->stats, DSV_STAGE_MC, t);
 #endif
     } else {
-        dsv_frame_copy(img->out_frame, residual);
+        dsv_frame_copy(img->out_frame, job->residual);
     }
 
-    if (is_ref) {
+    if (job->is_ref) {
         img->ref_frame = dsv_extend_frame(dsv_frame_ref_inc(img->out_frame));  
     }
 
     /* draw debug information on the frame */
     if (d->draw_info && p->has_ref) {
         DSV_FRAME *tmp = dsv_clone_frame(img->out_frame, 0);
-        draw_info(img, tmp, mvs, d->draw_info);
+        draw_info(img, tmp, job->mvs, d->draw_info);
         dsv_frame_ref_dec(img->out_frame);
         img->out_frame = tmp;
     }
     /* release resources */
-    if (is_ref) {
+    if (job->is_ref) {
         if (d->ref) {
             img_unref(d->ref);
         }
@@ -455,18 +565,173 @@ dsv_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
         d->ref = img;
     }
     
-    dsv_frame_ref_dec(residual);
-    if (mvs) {
-        dsv_free(mvs);
-    }
-    if (buffer) {
-        dsv_buf_free(buffer);
-    }
-        
     img_unref(img);
+    job->img = NULL;
+    job_free(job);
     
     *out = dsv_frame_ref_inc(img->out_frame);
     
     img_unref(img);
+    dsv_stats_frame(&d->stats, job->start);
     return DSV_DEC_OK;
 }
+
+static void
+pipe_main(void *arg)
+{
+    struct DSV_DEC_PIPE *pp = arg;
+    struct DEC_JOB *job;
+
+    while (1) {
+        dsv_mutex_lock(pp->lock);
+        while (!pp->stop && pp->ndecoded == pp->nqueued) {
+            dsv_cond_wait(pp->cond, pp->lock);
+        }
+        if (pp->ndecoded == pp->nqueued) { /* stopped and nothing left */
+            dsv_mutex_unlock(pp->lock);
+            break;
+        }
+        job = &pp->jobs[pp->ndecoded % (pp->depth + 1)];
+        dsv_mutex_unlock(pp->lock);
+
+        /* the job is not touched by the caller until it has been decoded */
+        decode_packet(&pp->meta, &pp->got_metadata, job);
+
+        dsv_mutex_lock(pp->lock);
+        pp->ndecoded++;
+        dsv_cond_broadcast(pp->cond);
+        dsv_mutex_unlock(pp->lock);
+    }
+}
+
+static void
+pipe_free(struct DSV_DEC_PIPE *pp)
+{
+    long i;
+
+    if (pp->thread) {
+        dsv_mutex_lock(pp->lock);
+        pp->stop = 1;
+        dsv_cond_broadcast(pp->cond);
+        dsv_mutex_unlock(pp->lock);
+        dsv_thread_join(pp->thread);
+        /* whatever was never returned to the caller */
+        for (i = pp->nretired; i < pp->nqueued; i++) {
+            job_free(&pp->jobs[i % (pp->depth + 1)]);
+        }
+    }
+    dsv_cond_free(pp->cond);
+    dsv_mutex_free(pp->lock);
+    if (pp->jobs) {
+        dsv_free(pp->jobs);
+    }
+    dsv_free(pp);
+}
+
+/* returns 0 if there is no thread to decode on (no DSV_MT) */
+static int
+pipe_start(DSV_DECODER *d)
+{
+    struct DSV_DEC_PIPE *pp;
+
+    pp = dsv_alloc(sizeof(*pp));
+    pp->depth = d->pipeline;
+    pp->meta = d->vidmeta;
+    pp->got_metadata = d->got_metadata;
+    pp->jobs = dsv_alloc(sizeof(*pp->jobs) * (pp->depth + 1));
+    pp->lock = dsv_mutex_new();
+    pp->cond = dsv_cond_new();
+    if (pp->lock && pp->cond) {
+        pp->thread = dsv_thread_start(pipe_main, pp);
+    }
+    if (pp->thread == NULL) {
+        pipe_free(pp);
+        return 0;
+    }
+    DSV_INFO(("decoding up to %d pictures ahead on a separate thread", pp->depth));
+    d->pipe = pp;
+    return 1;
+}
+
+static int
+pipe_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
+{
+    struct DSV_DEC_PIPE *pp = d->pipe;
+    struct DEC_JOB *job;
+    
+    /* nqueued and nretired only ever change on this side */
+    if (buffer) {
+        /* at most 'depth' are left queued after every call, so this slot
+         * has already been returned */
+        job = &pp->jobs[pp->nqueued % (pp->depth + 1)];
+        memset(job, 0, sizeof(*job));
+        job->buf = *buffer;
+        job->scale = d->scale;
+        job->stats.enabled = d->stats.enabled;
+
+        dsv_mutex_lock(pp->lock);
+        pp->nqueued++;
+        dsv_cond_broadcast(pp->cond);
+        dsv_mutex_unlock(pp->lock);
+        if (pp->nqueued - pp->nretired <= pp->depth) {
+            return DSV_DEC_NEED_NEXT;
+        }
+    } else if (pp->nqueued == pp->nretired) {
+        return DSV_DEC_EOS;
+    }
+    dsv_mutex_lock(pp->lock);
+    while (pp->ndecoded == pp->nretired) {
+        dsv_cond_wait(pp->cond, pp->lock);
+    }
+    dsv_mutex_unlock(pp->lock);
+    
+    job = &pp->jobs[pp->nretired % (pp->depth + 1)];
+    pp->nretired++;
+    return reconstruct(d, job, out, fn);
+}
+
+extern void
+dsv_dec_free(DSV_DECODER *d)
+{
+    if (d->pipe) {
+        pipe_free(d->pipe);
+        d->pipe = NULL;
+    }
+    if (d->ref) {
+        img_unref(d->ref);
+    }
+}
+
+extern DSV_META *
+dsv_get_metadata(DSV_DECODER *d)
+{
+    DSV_META *meta;
+    
+    meta = dsv_alloc(sizeof(DSV_META));
+    memcpy(meta, &d->vidmeta, sizeof(DSV_META));
+    
+    return meta;
+}
+
+extern int
+dsv_dec(DSV_DECODER *d, DSV_BUF *buffer, DSV_FRAME **out, DSV_FNUM *fn)
+{
+    struct DEC_JOB job;
+
+    *fn = -1;
+    if (d->pipeline > 0 && d->pipe == NULL && !pipe_start(d)) {
+        d->pipeline = 0;
+    }
+    if (d->pipe) {
+        return pipe_dec(d, buffer, out, fn);
+    }
+    if (buffer == NULL) {
+        return DSV_DEC_EOS;
+    }
+    memset(&job, 0, sizeof(job));
+    job.buf = *buffer;
+    job.scale = d->scale;
+    job.stats.enabled = d->stats.enabled;
+    decode_packet(&d->vidmeta, &d->got_metadata, &job);
+    return reconstruct(d, &job, out, fn);
+}
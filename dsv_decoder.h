@@ -24,9 +24,11 @@ extern "C" {
 #include "dsv.h"
 
 typedef struct {
+    DSV_META meta; /* what params.vidmeta points to */
     DSV_PARAMS params;
     DSV_FRAME *out_frame;
     DSV_FRAME *ref_frame;
+    DSV_FRAME *ref_hp[DSV_HP_PLANES]; /* see DSV_DECODER hpel_planes */
     
     unsigned char *stable_blocks;
     int refcount;
@@ -39,16 +41,47 @@ typedef struct {
 #define DSV_DRAW_MOVECS 2 /* motion vectors */
 #define DSV_DRAW_IBLOCK 4 /* intra subblocks */
     int draw_info; /* set by user */
+    /* set by user, interpolate whole reference frames to half-pel instead
+     * of block by block. costs up to three extra frames of memory, see
+     * DSV_ENCODER hpel_planes */
+    int hpel_planes;
+    /* set by user, threads motion compensation is split over. only makes a
+     * difference with DSV_MT, the output is the same either way. 0 = 1 */
+    int threads;
+    /* set by user, number of pictures to entropy decode and inverse
+     * transform on a separate thread while earlier ones are still being
+     * motion compensated. pictures then come out of dsv_dec that many
+     * calls after their packet went in (see below). only makes a
+     * difference with DSV_MT, it is set back to 0 otherwise. can be
+     * turned on after packets were already decoded without it. 0 = off */
+    int pipeline;
+    /* set by user, output pictures at 1 / (1 << scale) of the size given
+     * in the metadata, up to DSV_MAX_SCALE. the lower resolution comes
+     * straight from the lower subbands, the highest ones are neither
+     * entropy decoded nor inverse transformed and motion compensation runs
+     * at the lower resolution with scaled down vectors. intra pictures come
+     * out close to a downscaled full decode, predicted ones drift from it
+     * a little until the next intra picture. only change it before an
+     * intra picture. 0 = full size */
+    int scale;
+    struct DSV_DEC_PIPE *pipe;
     int got_metadata;
+    DSV_STATS stats; /* set stats.enabled to also time things */
 } DSV_DECODER;
 
+#define DSV_MAX_SCALE 2 /* quarter size */
+
 #define DSV_DEC_OK        0
 #define DSV_DEC_ERROR     1
 #define DSV_DEC_EOS       2
 #define DSV_DEC_GOT_META  3
 #define DSV_DEC_NEED_NEXT 4
 
-/* decode a buffer, returns a frame in *out and the frame number in *fn */
+/* decode a buffer, returns a frame in *out and the frame number in *fn.
+ * with pipeline set, DSV_DEC_NEED_NEXT is returned until enough packets are
+ * queued. once there are no more packets, keep calling it with buf NULL to
+ * get the remaining pictures until it returns DSV_DEC_EOS. frames always
+ * come out in the order of their packets */
 extern int dsv_dec(DSV_DECODER *d, DSV_BUF *buf, DSV_FRAME **out, DSV_FNUM *fn);
 
 /* get the metadata that was decoded. NOTE: if no metadata has been decoded
@@ -15,6 +15,7 @@
 /*****************************************************************************/
 
 #include "dsv_encoder.h"
+#include "platform.h"
 
 static void
 encdat_ref(DSV_ENCDATA *d)
@@ -55,6 +56,8 @@ encdat_unref(DSV_ENCODER *enc, DSV_ENCDATA *d)
     if (d->residual) {
         dsv_frame_ref_dec(d->residual);
     }
+    dsv_hpel_planes_free(d->padded_hp);
+    dsv_hpel_planes_free(d->recon_hp);
     if (d->refdata) {
         encdat_unref(enc, d->refdata);
         d->refdata = NULL;
@@ -63,10 +66,51 @@ encdat_unref(DSV_ENCODER *enc, DSV_ENCDATA *d)
         dsv_free(d->final_mvs);
         d->final_mvs = NULL;
     }
+    if (d->blkstats) {
+        dsv_free(d->blkstats);
+        d->blkstats = NULL;
+    }
 
     dsv_free(d);
 }
 
+/* bpf = bytes per frame */
+static unsigned
+nominal_bpf(DSV_ENCODER *enc)
+{
+    unsigned fps;
+
+    fps = (enc->vidmeta.fps_num << 5) / enc->vidmeta.fps_den;
+    if (fps == 0) {
+        fps = 1;
+    }
+    return ((enc->bitrate << 5) / fps) >> 3;
+}
+
+static void
+start_gop_budget(DSV_ENCODER *enc)
+{
+    unsigned bpf;
+
+    enc->gop_frames = enc->gop;
+    if (enc->gop_frames <= 0 || enc->gop_frames > DSV_BUDGET_MAX) {
+        enc->gop_frames = DSV_BUDGET_MAX;
+    }
+    bpf = nominal_bpf(enc);
+    if (bpf > UINT_MAX / enc->gop_frames) {
+        bpf = UINT_MAX / enc->gop_frames;
+    }
+    enc->gop_budget = bpf * enc->gop_frames;
+    enc->gop_spent = 0;
+    enc->gop_coded = 0;
+    enc->gop_I_spent = 0;
+    enc->gop_P_spent = 0;
+    enc->gop_I_frames = 0;
+    enc->total_P_frame_q = 0;
+    enc->gop_P_frames = 0;
+    DSV_INFO(("RC GOP budget %u bytes over %d frames", enc->gop_budget, enc->gop_frames));
+}
+
 static void
 quality2quant(DSV_ENCODER *enc, DSV_ENCDATA *d, int forced_intra)
 {    
@@ -82,19 +126,37 @@ quality2quant(DSV_ENCODER *enc, DSV_ENCDATA *d, int forced_intra)
     
     q = enc->rc_quant;
     if (enc->rc_mode != DSV_RATE_CONTROL_CRF) {
-        DSV_META *vfmt = d->params.vidmeta;
-        int fps, bpf, needed_bpf, dir, delta, low_p, minq, nudged = 0;
-        
-        fps = (vfmt->fps_num << 5) / vfmt->fps_den;
-        if (fps == 0) {
-            fps = 1;
-        }
-        /* bpf = bytes per frame */
-        needed_bpf = ((enc->bitrate << 5) / fps) >> 3;
+        int bpf, needed_bpf, dir, delta, low_p, minq, nudged = 0;
         
-        bpf = enc->bpf_avg;
-        if (bpf == 0) {
+        if (enc->gop_budgets) {
+            unsigned nominal, left;
+            
+            /* spread what is left of the GOP budget over the remaining frames */
+            nominal = enc->gop_budget / enc->gop_frames;
+            left = 0;
+            if (enc->gop_budget > enc->gop_spent) {
+                left = enc->gop_budget - enc->gop_spent;
+            }
+            left /= (enc->gop_frames - enc->gop_coded);
+            needed_bpf = CLAMP(left, nominal / 4, nominal * 4);
+            if (needed_bpf <= 0) {
+                needed_bpf = 1;
+            }
+            
+            /* compare against what frames of this type have been costing */
             bpf = needed_bpf;
+            if (d->isP && enc->gop_P_frames > 0) {
+                bpf = enc->gop_P_spent / enc->gop_P_frames;
+            } else if (!d->isP && enc->gop_I_frames > 0) {
+                bpf = enc->gop_I_spent / enc->gop_I_frames;
+            }
+        } else {
+            needed_bpf = nominal_bpf(enc);
+            
+            bpf = enc->bpf_avg;
+            if (bpf == 0) {
+                bpf = needed_bpf;
+            }
         }
         dir = (bpf - needed_bpf) > 0 ? -1 : 1;
 
@@ -167,6 +229,37 @@ quality2quant(DSV_ENCODER *enc, DSV_ENCDATA *d, int forced_intra)
     DSV_DEBUG(("frame quant = %d", d->quant));
 }
 
+static void
+new_packet(DSV_ENCODER *enc, DSV_BUF *buf, unsigned size)
+{
+    if (enc->has_sink) {
+        memset(buf, 0, sizeof(*buf));
+        buf->data = enc->sink.acquire(enc->sink.user, size);
+        if (buf->data) {
+            memset(buf->data, 0, size); /* bitstream writer needs zeros */
+            buf->len = size;
+            enc->pkt_internal = 0;
+            return;
+        }
+        DSV_ERROR(("sink did not provide a buffer"));
+    }
+    dsv_mk_buf(buf, size);
+    enc->pkt_internal = 1;
+}
+
+static void
+out_packet(DSV_ENCODER *enc, DSV_BUF *buf, DSV_BUF *bufs, int *nbuf)
+{
+    if (!enc->has_sink) {
+        bufs[(*nbuf)++] = *buf;
+        return;
+    }
+    enc->sink.emit(enc->sink.user, buf->data, buf->len);
+    if (enc->pkt_internal) {
+        dsv_buf_free(buf);
+    }
+}
+
 /* B.1 Packet Header Link Offsets */
 static void
 set_link_offsets(DSV_ENCODER *enc, DSV_BUF *buffer, int is_eos)
@@ -191,19 +284,43 @@ set_link_offsets(DSV_ENCODER *enc, DSV_BUF *buffer, int is_eos)
     enc->prev_link = next_link;
 }
 
+/* the parent's data for the frame currently being encoded, if any */
+static DSV_ENCDATA *
+parent_data(DSV_ENCODER *enc, DSV_ENCDATA *d)
+{
+    if (enc->parent == NULL || enc->parent->ref == NULL) {
+        return NULL;
+    }
+    if (enc->parent->ref->fnum != d->fnum) {
+        return NULL;
+    }
+    return enc->parent->ref;
+}
+
 static void
 mk_pyramid(DSV_ENCODER *enc, DSV_ENCDATA *d)
 {
     int i, fmt;
     DSV_FRAME *prev;
+    DSV_ENCDATA *pd;
     int orig_w, orig_h;
     
     fmt = d->padded_frame->format;
     orig_w = d->padded_frame->width;
     orig_h = d->padded_frame->height;
+    pd = parent_data(enc, d);
     
     prev = d->padded_frame;
     for (i = 0; i < enc->pyramid_levels; i++) {
+        /* our input is the parent's first level so the parent's next level
+         * is the same as ours whenever the dimensions line up */
+        if (pd && (i + 1) < enc->parent->pyramid_levels && pd->pyramid[i + 1] &&
+                pd->pyramid[i + 1]->width == DSV_ROUND_SHIFT(orig_w, i + 1) &&
+                pd->pyramid[i + 1]->height == DSV_ROUND_SHIFT(orig_h, i + 1)) {
+            d->pyramid[i] = dsv_frame_ref_inc(pd->pyramid[i + 1]);
+            prev = d->pyramid[i];
+            continue;
+        }
         d->pyramid[i] = dsv_mk_frame(
                 fmt,
                 DSV_ROUND_SHIFT(orig_w, i + 1),
@@ -216,17 +333,77 @@ mk_pyramid(DSV_ENCODER *enc, DSV_ENCDATA *d)
     }
 }
 
+/* the parent's motion vectors scaled down to our resolution */
+static DSV_MV *
+parent_seeds(DSV_ENCODER *enc, DSV_ENCDATA *d)
+{
+    DSV_ENCDATA *pd;
+    DSV_PARAMS *p = &d->params;
+    DSV_PARAMS *pp;
+    DSV_MV *seeds, *mv;
+    int i, j, pi, pj;
+    
+    pd = parent_data(enc, d);
+    if (pd == NULL || pd->final_mvs == NULL) {
+        return NULL;
+    }
+    pp = &pd->params;
+    seeds = dsv_alloc_tag(sizeof(DSV_MV) * p->nblocks_h * p->nblocks_v, DSV_MEM_MOTION);
+    for (j = 0; j < p->nblocks_v; j++) {
+        /* parent block containing the center of this block */
+        pj = (2 * (j * p->blk_h + p->blk_h / 2)) / pp->blk_h;
+        pj = MIN(pj, pp->nblocks_v - 1);
+        for (i = 0; i < p->nblocks_h; i++) {
+            pi = (2 * (i * p->blk_w + p->blk_w / 2)) / pp->blk_w;
+            pi = MIN(pi, pp->nblocks_h - 1);
+            mv = &pd->final_mvs[pi + pj * pp->nblocks_h];
+            if (mv->mode == DSV_MODE_INTER) {
+                /* half-pel at twice the resolution = quarter of a pixel here */
+                seeds[i + j * p->nblocks_h].u.mv.x = mv->u.mv.x >> 2;
+                seeds[i + j * p->nblocks_h].u.mv.y = mv->u.mv.y >> 2;
+            }
+        }
+    }
+    return seeds;
+}
+
 static int
 motion_est(DSV_ENCODER *enc, DSV_ENCDATA *d)
 {
-    int i, intra_pct;
+    int i, intra_pct, nblk;
     DSV_PARAMS *p = &d->params;
     DSV_HME hme;
     DSV_ENCDATA *ref = d->refdata;
     
     memset(&hme, 0, sizeof(hme));
-    hme.levels = enc->pyramid_levels;
+    hme.levels = MIN(enc->pyramid_levels, enc->effort.max_pyramid_levels);
     hme.params = &d->params;
+    hme.seed = parent_seeds(enc, d);
+    hme.ref_mvs = ref->final_mvs;
+    if (enc->temporal_mvs && hme.ref_mvs) {
+        hme.temporal = 1;
+        /* steady motion is already covered by the reference's vectors */
+        if (hme.levels > 3) {
+            hme.levels--;
+        }
+    }
+    hme.effort = &enc->effort;
+    /* never promoted without intra blocks */
+    hme.intra_thresh = enc->effort.intra ? enc->intra_pct_thresh : -1;
+    if (enc->hpel_planes) {
+        hme.ref_hp = ref->padded_hp;
+    }
+    /* the reference's were filled in when it was motion estimated itself,
+     * unless it is an I frame */
+    nblk = p->nblocks_h * p->nblocks_v;
+    if (d->blkstats == NULL) {
+        d->blkstats = dsv_alloc_tag(sizeof(DSV_BLKSTAT) * nblk, DSV_MEM_MOTION);
+    }
+    if (ref->blkstats == NULL) {
+        ref->blkstats = dsv_alloc_tag(sizeof(DSV_BLKSTAT) * nblk, DSV_MEM_MOTION);
+    }
+    hme.src_stats = d->blkstats;
+    hme.ref_stats = ref->blkstats;
     
     hme.src[0] = d->padded_frame;
     hme.ref[0] = ref->padded_frame;
@@ -236,6 +413,9 @@ motion_est(DSV_ENCODER *enc, DSV_ENCDATA *d)
     }
 
     intra_pct = dsv_hme(&hme);
+    if (hme.seed) {
+        dsv_free(hme.seed);
+    }
     d->final_mvs = hme.mvf[0]; /* save result of HME */
     for (i = 1; i < hme.levels + 1; i++) {
         if (hme.mvf[i]) {
@@ -244,12 +424,22 @@ motion_est(DSV_ENCODER *enc, DSV_ENCDATA *d)
     }
 
     DSV_DEBUG(("intra block percent for frame %d = %d%%", d->fnum, intra_pct));
+    enc->stats.hpel_searched += hme.hpel_searched;
+    enc->stats.hpel_skipped += hme.hpel_skipped;
+    enc->stats.hpel_hits += hme.hpel_hits;
+    enc->stats.static_blocks += hme.static_blocks;
     
-    if (intra_pct > enc->intra_pct_thresh) {
+    if (hme.promoted || intra_pct > enc->intra_pct_thresh) {
         p->has_ref = 0;
-        DSV_INFO(("too much intra, inserting I frame %d%%", intra_pct));
+        if (hme.promoted) {
+            DSV_INFO(("too much intra, stopped motion estimation and inserting I frame"));
+        } else {
+            DSV_INFO(("too much intra, inserting I frame %d%%", intra_pct));
+        }
         return 1;
     }
+    enc->stats.blocks += p->nblocks_h * p->nblocks_v;
+    enc->stats.intra_blocks += hme.nintra;
     return 0;
 }
 
@@ -268,7 +458,7 @@ encode_motion(DSV_ENCDATA *d, DSV_BS *bs)
     upperbound = (params->nblocks_h * params->nblocks_v * 32);
     
     for (i = 0; i < DSV_SUB_NSUB; i++) {
-        bufs[i] = dsv_alloc(upperbound);
+        bufs[i] = dsv_alloc_tag(upperbound, DSV_MEM_BITS);
         if (i != DSV_SUB_MODE) {
             dsv_bs_init(&mbs[i], bufs[i]);
         } else {
@@ -339,7 +529,7 @@ encode_stable_blocks(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BS *bs)
     nblk = params->nblocks_h * params->nblocks_v;
     upperbound = (nblk * 32);
 
-    stabbuf = dsv_alloc(upperbound);
+    stabbuf = dsv_alloc_tag(upperbound, DSV_MEM_BITS);
     dsv_bs_init_rle(&stabrle, stabbuf);
 
     if (enc->refresh_ctr >= enc->stable_refresh) {
@@ -432,7 +622,7 @@ encode_metadata(DSV_ENCODER *enc, DSV_BUF *buf)
     DSV_META *meta = &enc->vidmeta;
     unsigned next_start = DSV_PACKET_NEXT_OFFSET;
 
-    dsv_mk_buf(buf, 64);
+    new_packet(enc, buf, 64);
     
     dsv_bs_init(&bs, buf->data);
     
@@ -468,7 +658,10 @@ encode_picture(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
     DSV_STABILITY stab;
     DSV_COEFS coefs[3];
     int i, width, height;
+    unsigned plane_start, plane_bytes[3];
+    unsigned long t;
     
+    t = dsv_timer_start(&enc->stats);
     width = enc->vidmeta.width;
     height = enc->vidmeta.height;
     upperbound = width * height;
@@ -488,7 +681,7 @@ encode_picture(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
             break;
     }
 
-    dsv_mk_buf(output_buf, upperbound);
+    new_packet(enc, output_buf, upperbound);
     
     dsv_bs_init(&bs, output_buf->data);
     /* B.2.3 Picture Packet */
@@ -502,12 +695,17 @@ encode_picture(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
     dsv_bs_put_ueg(&bs, d->params.blk_w >> 2);
     dsv_bs_put_ueg(&bs, d->params.blk_h >> 2);
     dsv_bs_align(&bs);
+    dsv_timer_stop(&enc->stats, DSV_STAGE_BITS, t);
     /* encode stability data */
+    t = dsv_timer_start(&enc->stats);
     encode_stable_blocks(enc, d, &bs);
+    dsv_timer_stop(&enc->stats, DSV_STAGE_STAB, t);
     if (d->params.has_ref) {
         dsv_bs_align(&bs);
         /* encode motion vecs and intra blocks */
+        t = dsv_timer_start(&enc->stats);
         encode_motion(d, &bs);
+        dsv_timer_stop(&enc->stats, DSV_STAGE_MOTION, t);
     }
     
     /* B.2.3.3 Image Data */
@@ -520,9 +718,20 @@ encode_picture(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
 
     for (i = 0; i < 3; i++) {
         stab.cur_plane = i;
+        t = dsv_timer_start(&enc->stats);
         dsv_fwd_sbt(&d->xf_frame->planes[i], &coefs[i], stab.isP);
+        dsv_timer_stop(&enc->stats, DSV_STAGE_FWD_SBT, t);
+        
+        t = dsv_timer_start(&enc->stats);
+        dsv_bs_align(&bs);
+        plane_start = dsv_bs_ptr(&bs);
         dsv_encode_plane(&bs, &coefs[i], d->quant, &stab);
-        dsv_inv_sbt(&d->xf_frame->planes[i], &coefs[i], d->quant, stab.isP, i);
+        plane_bytes[i] = dsv_bs_ptr(&bs) - plane_start - 4; /* - plane length */
+        dsv_timer_stop(&enc->stats, DSV_STAGE_HZCC, t);
+        
+        t = dsv_timer_start(&enc->stats);
+        dsv_inv_sbt(&d->xf_frame->planes[i], &coefs[i], d->quant, stab.isP, i, 0);
+        dsv_timer_stop(&enc->stats, DSV_STAGE_INV_SBT, t);
     }
 
     if (coefs[0].data) { /* only the first pointer is actual allocated data */
@@ -533,6 +742,10 @@ encode_picture(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
     dsv_bs_align(&bs);
 
     output_buf->len = dsv_bs_ptr(&bs);
+    for (i = 0; i < 3; i++) {
+        enc->stats.plane_bytes[i] += plane_bytes[i];
+    }
+    enc->stats.hdr_bytes += output_buf->len - (plane_bytes[0] + plane_bytes[1] + plane_bytes[2]);
 }
 
 static int
@@ -543,7 +756,8 @@ check_scene_change(DSV_ENCODER *enc, DSV_ENCDATA *d)
     al = dsv_frame_avg_luma(d->pyramid[enc->pyramid_levels - 1]);
     delta = abs(enc->prev_avg_luma - al);
     
-    if (delta > enc->scene_change_delta) {
+    /* negative when the previous frame is not known, see dsv_enc_continue_rc */
+    if (enc->prev_avg_luma >= 0 && delta > enc->scene_change_delta) {
         d->params.has_ref = 0;
         DSV_DEBUG(("scene change %d [%d %d]", delta, al, enc->prev_avg_luma));
         DSV_INFO(("scene change detected, inserting I frame [%d]", d->fnum));
@@ -553,6 +767,31 @@ check_scene_change(DSV_ENCODER *enc, DSV_ENCDATA *d)
     return did_sc;
 }
 
+static void
+mk_half(DSV_ENCODER *enc, DSV_ENCDATA *d)
+{
+    DSV_FRAME *src = d->padded_frame;
+    int j;
+    
+    if (enc->half) {
+        dsv_frame_ref_dec(enc->half);
+    }
+    enc->half = dsv_mk_frame(src->format,
+            DSV_ROUND_SHIFT(src->width, 1),
+            DSV_ROUND_SHIFT(src->height, 1), 0);
+    dsv_ds2x_frame_chroma(enc->half, src);
+    if (d->pyramid[0] == NULL) {
+        dsv_ds2x_frame_luma(enc->half, src);
+        return;
+    }
+    /* luma was already downscaled for motion estimation */
+    for (j = 0; j < enc->half->planes[0].h; j++) {
+        memcpy(DSV_GET_LINE(&enc->half->planes[0], j),
+               DSV_GET_LINE(&d->pyramid[0]->planes[0], j),
+               enc->half->planes[0].w);
+    }
+}
+
 static int
 size4dim(int dim)
 {
@@ -571,13 +810,15 @@ size4dim(int dim)
     return DSV_MIN_BLOCK_SIZE;
 }
 
-static int
-encode_one_frame(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
+/* metadata (if any) goes out right away, the picture is left in output_buf */
+static void
+encode_one_frame(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf, DSV_BUF *bufs, int *nbuf)
 {
     DSV_PARAMS *p;
     int i, w, h;
     int gop_start = 0;
     int forced_intra = 0;
+    unsigned long t;
     
     p = &d->params;
     p->vidmeta = &enc->vidmeta;
@@ -609,22 +850,42 @@ encode_one_frame(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
         while ((1 << lvls) > maxdim) {
             lvls--;
         }
-        enc->pyramid_levels = CLAMP(lvls, 3, DSV_MAX_PYRAMID_LEVELS);
+        enc->pyramid_levels = CLAMP(lvls, 3, enc->effort.max_pyramid_levels);
     }
 
     DSV_DEBUG(("gop length %d", enc->gop));
+    t = dsv_timer_start(&enc->stats);
     if (enc->gop != DSV_GOP_INTRA) {
         d->padded_frame = dsv_clone_frame(d->input_frame, 1);
         
         dsv_extend_frame(d->padded_frame);
         mk_pyramid(enc, d);
+    } else if (enc->nchildren) {
+        /* downscaling needs the border */
+        d->padded_frame = dsv_clone_frame(d->input_frame, 1);
+        dsv_extend_frame(d->padded_frame);
     } else {
         d->padded_frame = dsv_clone_frame(d->input_frame, 0);
     }
+    if (enc->nchildren) {
+        mk_half(enc, d);
+    }
+    dsv_timer_stop(&enc->stats, DSV_STAGE_PYRAMID, t);
     if (enc->force_metadata || ((enc->prev_gop + enc->gop) <= d->fnum)) {
+        DSV_BUF metabuf;
+        
         gop_start = 1;
         enc->prev_gop = d->fnum;
         enc->force_metadata = 0;
+        /* send metadata first, then compressed frame */
+        encode_metadata(enc, &metabuf);
+        out_packet(enc, &metabuf, bufs, nbuf);
+    }
+    if (enc->rc_mode != DSV_RATE_CONTROL_CRF && enc->gop_budgets) {
+        if ((gop_start && enc->gop != DSV_GOP_INTRA) ||
+                enc->gop_coded >= enc->gop_frames) {
+            start_gop_budget(enc);
+        }
     }
 
     if (enc->gop == DSV_GOP_INTRA) {
@@ -651,16 +912,29 @@ encode_one_frame(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
         }
     }
     if (d->params.has_ref) {
+        t = dsv_timer_start(&enc->stats);
         forced_intra = motion_est(enc, d);
+        dsv_timer_stop(&enc->stats, DSV_STAGE_HME, t);
     }
     quality2quant(enc, d, forced_intra);
     dsv_frame_copy(d->xf_frame, d->padded_frame);
     if (d->params.has_ref) {        
-        dsv_sub_pred(d->final_mvs, &d->params, d->residual, d->xf_frame, d->refdata->recon_frame);
+        DSV_ENCDATA *ref = d->refdata;
+        DSV_FRAME **hp = NULL;
+        
+        t = dsv_timer_start(&enc->stats);
+        if (enc->hpel_planes) {
+            hp = ref->recon_hp;
+            dsv_hpel_planes(ref->recon_frame, hp, 3, dsv_hpel_phases(d->final_mvs, &d->params));
+        }
+        dsv_sub_pred(d->final_mvs, &d->params, d->residual, d->xf_frame, ref->recon_frame, hp);
+        dsv_timer_stop(&enc->stats, DSV_STAGE_MC, t);
     }
     encode_picture(enc, d, output_buf);
     if (d->params.has_ref) {
+        t = dsv_timer_start(&enc->stats);
         dsv_frame_add(d->xf_frame, d->residual);
+        dsv_timer_stop(&enc->stats, DSV_STAGE_MC, t);
     }
     if (d->params.is_ref && enc->gop != DSV_GOP_INTRA) {
         DSV_FRAME *frame;
@@ -673,10 +947,8 @@ encode_one_frame(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
         d->recon_frame = frame;
     }
 
-    if (d->final_mvs) {
-        dsv_free(d->final_mvs);
-        d->final_mvs = NULL;
-    }
+    /* final_mvs are kept (and freed with the rest of the data) while this
+     * frame is referenced so children of this encoder can use them */
     if (d->refdata) {
         encdat_unref(enc, d->refdata);
         d->refdata = NULL;
@@ -690,7 +962,47 @@ encode_one_frame(DSV_ENCODER *enc, DSV_ENCDATA *d, DSV_BUF *output_buf)
             }
         }
     }
-    return gop_start;
+}
+
+static DSV_EFFORT presets[DSV_NUM_PRESETS] = {
+    { 5, 0, 1, 0, 0, 3, 1 }, /* ultrafast */
+    { 5, 4, 16, 1, 0, 4, 1 }, /* fast */
+    { DSV_FPEL_NSEARCH, DSV_HPEL_NSEARCH, 4, 2, 1, DSV_MAX_PYRAMID_LEVELS, 1 }, /* medium */
+    { DSV_FPEL_NSEARCH, DSV_HPEL_NSEARCH, 1, 2, 1, DSV_MAX_PYRAMID_LEVELS, 0 }, /* slow */
+};
+
+/* # of frames in a row that have to come in under 3/4 of the deadline
+ * before trying the next slower preset again */
+#define DEADLINE_RECOVERY 16
+
+/* one preset step per frame at most, quick to drop and slow to recover so
+ * it doesn't keep going back and forth between two presets */
+static void
+deadline_control(DSV_ENCODER *enc, unsigned long usec)
+{
+    if (usec > enc->deadline) {
+        enc->stats.deadline_misses++;
+        enc->under_deadline = 0;
+        if (enc->effort_level > DSV_PRESET_ULTRAFAST) {
+            enc->effort_level--;
+            enc->effort = presets[enc->effort_level];
+            enc->stats.effort_drops++;
+            DSV_INFO(("frame took %luus > %uus, lowering effort to preset %d",
+                    usec, enc->deadline, enc->effort_level));
+        }
+        return;
+    }
+    if (usec > enc->deadline * 3 / 4) {
+        enc->under_deadline = 0;
+        return;
+    }
+    if (++enc->under_deadline >= DEADLINE_RECOVERY && enc->effort_level < enc->preset) {
+        enc->effort_level++;
+        enc->effort = presets[enc->effort_level];
+        enc->under_deadline = 0;
+        enc->stats.effort_raises++;
+        DSV_INFO(("raising effort to preset %d", enc->effort_level));
+    }
 }
 
 extern void
@@ -703,6 +1015,8 @@ dsv_enc_init(DSV_ENCODER *enc)
     enc->quality = DSV_QUALITY_PERCENT(85);
     enc->gop = 24;
     enc->pyramid_levels = 0;
+    enc->preset = DSV_PRESET_SLOW;
+    enc->effort = presets[DSV_PRESET_SLOW];
     enc->rc_mode = DSV_RATE_CONTROL_CRF;
     enc->bitrate = INT_MAX;
     enc->max_q_step = DSV_MAX_QUALITY * 1 / 200;
@@ -712,6 +1026,9 @@ dsv_enc_init(DSV_ENCODER *enc)
     enc->rc_high_motion_nudge = 1;
     enc->bpf_total = 0;
     enc->bpf_avg = 0;
+    enc->gop_budgets = 0;
+    enc->gop_frames = 0;
+    enc->gop_coded = 0;
     enc->last_P_frame_over = 0;
     
     enc->intra_pct_thresh = 50;
@@ -725,14 +1042,80 @@ extern void
 dsv_enc_start(DSV_ENCODER *enc)
 {
     enc->quality = CLAMP(enc->quality, 0, DSV_MAX_QUALITY);
+    enc->preset = CLAMP(enc->preset, 0, DSV_NUM_PRESETS - 1);
+    enc->effort_level = enc->preset;
+    enc->effort = presets[enc->effort_level];
+    enc->under_deadline = 0;
     if (enc->rc_mode != DSV_RATE_CONTROL_CRF) {
         enc->rc_quant = enc->quality;
         enc->avg_P_frame_q = enc->quality * 4 / 5;
     }
+    enc->rc_bytes = 0;
+    enc->rc_frames = 0;
+    enc->rc_P_q = 0;
+    enc->rc_P_frames = 0;
 
     enc->force_metadata = 1;
 }
 
+extern void
+dsv_enc_continue_rc(DSV_ENCODER *enc, DSV_ENCODER *prev)
+{
+    if (enc->rc_mode == DSV_RATE_CONTROL_CRF) {
+        return;
+    }
+    enc->rc_quant = prev->rc_quant;
+    enc->bpf_total = prev->bpf_total;
+    enc->bpf_reset = prev->bpf_reset;
+    enc->bpf_avg = prev->bpf_avg;
+    enc->total_P_frame_q = prev->total_P_frame_q;
+    enc->avg_P_frame_q = prev->avg_P_frame_q;
+    enc->last_P_frame_over = prev->last_P_frame_over;
+    enc->back_into_range = prev->back_into_range;
+    /* the first frame is not a scene change just because the encoder
+     * has not seen the frame before it */
+    enc->prev_avg_luma = -1;
+}
+
+extern void
+dsv_enc_join_rc(DSV_ENCODER *enc, DSV_ENCODER *start, DSV_ENCODER *piece)
+{
+    int q, lim;
+    
+    if (enc->rc_mode == DSV_RATE_CONTROL_CRF) {
+        return;
+    }
+    /* the quality moves as much as it did over the piece, by at most
+     * max_q_step for each frame the piece coded (up to DSV_BPF_RESET) */
+    lim = enc->max_q_step * MIN(piece->rc_frames, DSV_BPF_RESET);
+    q = (int) piece->rc_quant - (int) start->rc_quant;
+    q = CLAMP(q, -lim, lim) + (int) enc->rc_quant;
+    enc->rc_quant = CLAMP(q, enc->min_quality, enc->max_quality);
+    if (piece->rc_frames == 0) {
+        return;
+    }
+    enc->bpf_total += piece->rc_bytes;
+    enc->bpf_reset += piece->rc_frames;
+    enc->total_P_frame_q += piece->rc_P_q;
+    enc->bpf_avg = enc->bpf_total / enc->bpf_reset;
+    if (enc->gop_budgets) {
+        if (piece->rc_P_frames > 0) {
+            enc->avg_P_frame_q = piece->rc_P_q / piece->rc_P_frames;
+        }
+    } else {
+        enc->avg_P_frame_q = enc->total_P_frame_q / enc->bpf_reset;
+    }
+    if (enc->bpf_reset >= DSV_BPF_RESET) {
+        enc->bpf_total = enc->bpf_avg;
+        if (!enc->gop_budgets) {
+            enc->total_P_frame_q = enc->total_P_frame_q / enc->bpf_reset;
+        }
+        enc->bpf_reset = 1;
+    }
+    enc->last_P_frame_over = piece->last_P_frame_over;
+    enc->back_into_range = piece->back_into_range;
+}
+
 extern void
 dsv_enc_free(DSV_ENCODER *enc)
 {    
@@ -748,6 +1131,10 @@ dsv_enc_free(DSV_ENCODER *enc)
         dsv_free(enc->stable_blocks);
         enc->stable_blocks = NULL;
     }
+    if (enc->half) {
+        dsv_frame_ref_dec(enc->half);
+        enc->half = NULL;
+    }
 }
 
 extern void
@@ -762,21 +1149,49 @@ dsv_enc_force_metadata(DSV_ENCODER *enc)
     enc->force_metadata = 1;
 }
 
+extern void
+dsv_enc_set_parent(DSV_ENCODER *enc, DSV_ENCODER *parent)
+{
+    enc->parent = parent;
+    parent->nchildren++;
+}
+
+extern DSV_FRAME *
+dsv_enc_downscaled(DSV_ENCODER *enc)
+{
+    if (enc->half == NULL) {
+        return NULL;
+    }
+    return dsv_frame_ref_inc(enc->half);
+}
+
 /* B.2.2 End of Stream Packet */
 extern void
 dsv_enc_end_of_stream(DSV_ENCODER *enc, DSV_BUF *bufs)
 {
     DSV_BS bs;
+    DSV_BUF buf;
+    int nbuf = 0;
     
-    dsv_mk_buf(&bufs[0], DSV_PACKET_HDR_SIZE);
-    dsv_bs_init(&bs, bufs[0].data);
+    new_packet(enc, &buf, DSV_PACKET_HDR_SIZE);
+    dsv_bs_init(&bs, buf.data);
     
     encode_packet_hdr(&bs, DSV_PT_EOS);
 
-    set_link_offsets(enc, &bufs[0], 1);
+    set_link_offsets(enc, &buf, 1);
+    out_packet(enc, &buf, bufs, &nbuf);
     DSV_INFO(("creating end of stream packet"));
 }
 
+extern void
+dsv_enc_set_sink(DSV_ENCODER *enc, DSV_SINK *sink)
+{
+    enc->has_sink = (sink != NULL);
+    if (sink) {
+        enc->sink = *sink;
+    }
+}
+
 extern int
 dsv_enc(DSV_ENCODER *enc, DSV_FRAME *frame, DSV_BUF *bufs)
 {
@@ -784,11 +1199,16 @@ dsv_enc(DSV_ENCODER *enc, DSV_FRAME *frame, DSV_BUF *bufs)
     int w, h;
     int nbuf = 0;
     DSV_BUF outbuf;
+    unsigned long start, wall = 0;
 
-    if (bufs == NULL) {
+    if (bufs == NULL && !enc->has_sink) {
         DSV_ERROR(("null buffer list passed to encoder!"));
         return 0;
     }
+    start = dsv_timer_start(&enc->stats);
+    if (enc->deadline) {
+        wall = dsv_usec();
+    }
     d = dsv_alloc(sizeof(DSV_ENCDATA));
     
     d->refcount = 1;
@@ -801,13 +1221,7 @@ dsv_enc(DSV_ENCODER *enc, DSV_FRAME *frame, DSV_BUF *bufs)
     d->input_frame = frame;
     d->fnum = enc->next_fnum++;
 
-    if (encode_one_frame(enc, d, &outbuf)) {
-        DSV_BUF metabuf;
-        encode_metadata(enc, &metabuf);
-        /* send metadata first, then compressed frame */
-        bufs[nbuf++] = metabuf;
-    }
-    bufs[nbuf++] = outbuf;
+    encode_one_frame(enc, d, &outbuf, bufs, &nbuf);
     
     if (d->isP) {
         enc->refresh_ctr++; /* for averaging stable blocks */
@@ -816,19 +1230,26 @@ dsv_enc(DSV_ENCODER *enc, DSV_FRAME *frame, DSV_BUF *bufs)
     if (enc->rc_mode != DSV_RATE_CONTROL_CRF) {
         enc->bpf_total += outbuf.len;
         enc->bpf_reset++;
+        enc->rc_bytes += outbuf.len;
+        enc->rc_frames++;
+        enc->gop_spent += outbuf.len;
+        enc->gop_coded++;
         if (d->isP) {
-            unsigned fps, needed_bpf;
+            unsigned needed_bpf;
             int went_over;
             int went_under;
             
+            enc->gop_P_spent += outbuf.len;
             enc->total_P_frame_q += enc->rc_quant;
-            enc->avg_P_frame_q = enc->total_P_frame_q / enc->bpf_reset;
-            fps = (enc->vidmeta.fps_num << 5) / enc->vidmeta.fps_den;
-            if (fps == 0) {
-                fps = 1;
+            enc->gop_P_frames++;
+            enc->rc_P_q += enc->rc_quant;
+            enc->rc_P_frames++;
+            if (enc->gop_budgets) {
+                enc->avg_P_frame_q = enc->total_P_frame_q / enc->gop_P_frames;
+            } else {
+                enc->avg_P_frame_q = enc->total_P_frame_q / enc->bpf_reset;
             }
-            /* bpf = bytes per frame */
-            needed_bpf = ((enc->bitrate << 5) / fps) >> 3;
+            needed_bpf = nominal_bpf(enc);
             went_under = outbuf.len < (needed_bpf * 3 / 4);
             needed_bpf = (needed_bpf * 7 / 8);
             went_over = outbuf.len > needed_bpf;
@@ -836,19 +1257,28 @@ dsv_enc(DSV_ENCODER *enc, DSV_FRAME *frame, DSV_BUF *bufs)
             enc->last_P_frame_over = went_over;
             DSV_INFO(("RC last P over ? (%d > %d) : %d", outbuf.len, needed_bpf, enc->last_P_frame_over));
         } else {
+            enc->gop_I_spent += outbuf.len;
+            enc->gop_I_frames++;
             enc->last_P_frame_over = 0;
             enc->back_into_range = 0;
         }
         enc->bpf_avg = enc->bpf_total / enc->bpf_reset;
         if (enc->bpf_reset >= DSV_BPF_RESET) {
             enc->bpf_total = enc->bpf_avg;
-            enc->total_P_frame_q = enc->total_P_frame_q / enc->bpf_reset;
+            if (!enc->gop_budgets) {
+                enc->total_P_frame_q = enc->total_P_frame_q / enc->bpf_reset;
+            }
             enc->bpf_reset = 1;
         }
     }
     
     encdat_unref(enc, d);
 
-    set_link_offsets(enc, &bufs[nbuf - 1], 0);
+    set_link_offsets(enc, &outbuf, 0);
+    out_packet(enc, &outbuf, bufs, &nbuf);
+    dsv_stats_frame(&enc->stats, start);
+    if (enc->deadline) {
+        deadline_control(enc, dsv_usec() - wall);
+    }
     return nbuf;
 }
@@ -34,6 +34,56 @@ extern "C" {
 
 #define DSV_MAX_PYRAMID_LEVELS 5
 
+/* Speed Presets
+ *
+ * trade compression efficiency for encoding speed, measured on CIF and
+ * 720p material against SLOW (see README for the numbers):
+ *
+ * ULTRAFAST - small full-pel search, no half-pel search, no intra blocks
+ *             and at most 3 pyramid levels. For live use.
+ * FAST      - small full-pel search, cross shaped half-pel search on only
+ *             the worst predicted blocks, no chroma or quadrant intra checks.
+ * MEDIUM    - full search, half-pel search on fewer blocks.
+ * SLOW      - everything, the default.
+ *
+ * All but SLOW also skip motion search on static blocks.
+ */
+#define DSV_PRESET_ULTRAFAST 0
+#define DSV_PRESET_FAST      1
+#define DSV_PRESET_MEDIUM    2
+#define DSV_PRESET_SLOW      3
+#define DSV_NUM_PRESETS      4
+
+#define DSV_FPEL_NSEARCH 9 /* search points for full-pel search */
+#define DSV_HPEL_NSEARCH 8 /* search points for half-pel search */
+
+/* how hard motion estimation and intra analysis try, set from the preset */
+typedef struct {
+    int fpel_points; /* 5 = center and cross, 9 = all */
+    int hpel_points; /* 0 = no half-pel, 4 = cross, 8 = all */
+    /* half-pel search is done when the full-pel SAD is above this many
+     * times the block area */
+    int hpel_thresh;
+    int intra; /* 0 = no intra blocks, 1 = luma analysis, 2 = + chroma */
+    int intra_split; /* check which quadrants of intra blocks to keep */
+    int max_pyramid_levels; /* most pyramid levels motion estimation uses */
+    /* give blocks that are (nearly) unchanged from the reference the zero
+     * vector without searching or analyzing them */
+    int static_skip;
+} DSV_EFFORT;
+
+/* level 0 statistics of a block, taken while motion estimating the frame
+ * and reused once it is the reference for the next one */
+#define DSV_BLKSTAT_VAR  1 /* var is known */
+#define DSV_BLKSTAT_AVG  2 /* avg is known */
+#define DSV_BLKSTAT_CVAR 4 /* cvar is known */
+typedef struct {
+    unsigned var; /* luma variance */
+    int avg; /* luma average */
+    unsigned cvar; /* largest chroma variance */
+    int known;
+} DSV_BLKSTAT;
+
 typedef struct _DSV_ENCDATA {
     int refcount;
     
@@ -44,6 +94,11 @@ typedef struct _DSV_ENCDATA {
     DSV_FRAME *recon_frame;
     DSV_FRAME *xf_frame;
     DSV_FRAME *residual;
+    /* half-pel planes of padded_frame (luma only) and recon_frame,
+     * built the first time they are needed when hpel_planes is on */
+    DSV_FRAME *padded_hp[DSV_HP_PLANES];
+    DSV_FRAME *recon_hp[DSV_HP_PLANES];
+    DSV_BLKSTAT *blkstats; /* one per block, see DSV_HME */
     
     DSV_PARAMS params;
     
@@ -55,7 +110,23 @@ typedef struct _DSV_ENCDATA {
     DSV_MV *final_mvs;
 } DSV_ENCDATA;
 
+/* Packet Sink
+ *
+ * lets the encoder write packets straight into memory owned by the caller
+ * instead of returning them from dsv_enc / dsv_enc_end_of_stream.
+ * acquire is asked for a buffer of at least 'size' bytes (a worst case for
+ * the packet), the packet is encoded into it and emit reports its final
+ * length. Packets are produced one at a time in stream order, so acquire
+ * can simply hand out the end of one growing buffer.
+ * If acquire returns NULL, emit is given a temporary buffer to copy from.
+ */
 typedef struct {
+    void *user;
+    uint8_t *(*acquire)(void *user, unsigned size);
+    void (*emit)(void *user, uint8_t *data, unsigned len);
+} DSV_SINK;
+
+typedef struct _DSV_ENCODER {
     int quality; /* user configurable, 0...DSV_MAX_QUALITY  */
     
     int gop;
@@ -79,6 +150,26 @@ typedef struct {
     int scene_change_delta;
     unsigned stable_refresh; /* # frames after which stability accum resets */
     int pyramid_levels;
+    int preset; /* DSV_PRESET_* */
+    /* real-time mode, microseconds each dsv_enc call should take at most.
+     * when a frame takes longer the effort is lowered one preset at a
+     * time, and raised again (never above 'preset') once frames are coming
+     * in comfortably under it. 0 = off */
+    unsigned deadline;
+    /* interpolate whole reference frames to half-pel instead of block by
+     * block. costs up to six extra frames of memory per reference. since a
+     * reference is only predicted from by the next frame this is usually
+     * slower, the output is the same either way */
+    int hpel_planes;
+    /* also start the motion search from the vectors the reference frame
+     * had, and search one pyramid level less since steady motion is found
+     * that way. changes the output */
+    int temporal_mvs;
+    /* ABR spends a byte budget per GOP instead of steering towards the
+     * running average of all frames so far, see below. meant for GOPs
+     * that are encoded separately (see dsv_enc_continue_rc), changes the
+     * output. 0 = off */
+    int gop_budgets;
     
     /* used internally */
     unsigned rc_quant;
@@ -87,8 +178,24 @@ typedef struct {
     unsigned bpf_total;
     unsigned bpf_reset;
     int bpf_avg;
+    /* with gop_budgets, nothing carries over from one GOP to the next
+     * except the quality the previous one ended at */
+#define DSV_BUDGET_MAX 256 /* max # of frames covered by one budget */
+    unsigned gop_budget; /* bytes allotted to the current GOP */
+    unsigned gop_spent; /* bytes used so far in the current GOP */
+    int gop_frames; /* # of frames the budget covers */
+    int gop_coded; /* # of frames coded so far with this budget */
+    unsigned gop_I_spent; /* bytes used by I frames in the current GOP */
+    unsigned gop_P_spent; /* bytes used by P frames in the current GOP */
+    int gop_I_frames;
+    int gop_P_frames;
     int total_P_frame_q;
     int avg_P_frame_q;
+    /* since dsv_enc_start, see dsv_enc_join_rc */
+    unsigned long rc_bytes;
+    unsigned long rc_frames;
+    unsigned long rc_P_q; /* sum of the P frame quality */
+    unsigned long rc_P_frames;
     int last_P_frame_over;
     int back_into_range;
     
@@ -97,6 +204,9 @@ typedef struct {
     DSV_META vidmeta;
     int prev_link;
     int force_metadata;
+    DSV_EFFORT effort;
+    int effort_level; /* preset the effort currently comes from */
+    int under_deadline; /* # of frames in a row well under the deadline */
     
     struct DSV_STAB_ACC {
         signed x : 16;
@@ -107,6 +217,17 @@ typedef struct {
     
     DSV_FNUM prev_gop;
     int prev_avg_luma;
+    
+    /* resolution ladder, see dsv_enc_set_parent */
+    struct _DSV_ENCODER *parent;
+    int nchildren;
+    DSV_FRAME *half; /* last input frame at half resolution */
+    
+    DSV_SINK sink;
+    int has_sink;
+    int pkt_internal; /* packet being encoded was not acquired from the sink */
+    
+    DSV_STATS stats; /* set stats.enabled to also time things */
 } DSV_ENCODER;
 
 extern void dsv_enc_init(DSV_ENCODER *enc);
@@ -114,9 +235,35 @@ extern void dsv_enc_free(DSV_ENCODER *enc);
 extern void dsv_enc_set_metadata(DSV_ENCODER *enc, DSV_META *md);
 extern void dsv_enc_force_metadata(DSV_ENCODER *enc);
 
+/* Resolution ladder
+ *
+ * makes enc encode the same video as parent at half its resolution
+ * (dimensions rounded up). enc's metadata must already be set accordingly.
+ * After every dsv_enc call on parent, the frame to give enc comes from
+ * dsv_enc_downscaled(parent). enc then reuses parent's downscaled frames
+ * and motion vectors instead of computing them from scratch.
+ */
+extern void dsv_enc_set_parent(DSV_ENCODER *enc, DSV_ENCODER *parent);
+/* returns NULL if enc has no children or has not encoded a frame yet.
+ * like any other input frame, the caller gives up its reference in dsv_enc */
+extern DSV_FRAME *dsv_enc_downscaled(DSV_ENCODER *enc);
+
 extern void dsv_enc_start(DSV_ENCODER *enc);
+/* rate control for streams that are encoded in pieces.
+ * dsv_enc_continue_rc makes 'enc' continue from where 'prev' left off
+ * instead of starting over, call it after dsv_enc_start.
+ * pieces encoded at the same time can all continue from the same 'start',
+ * dsv_enc_join_rc then moves the rate control of 'enc' (initially a copy
+ * of 'start') on as if it had encoded 'piece' itself. join the pieces in
+ * stream order */
+extern void dsv_enc_continue_rc(DSV_ENCODER *enc, DSV_ENCODER *prev);
+extern void dsv_enc_join_rc(DSV_ENCODER *enc, DSV_ENCODER *start, DSV_ENCODER *piece);
+
+/* NULL to go back to returning packets */
+extern void dsv_enc_set_sink(DSV_ENCODER *enc, DSV_SINK *sink);
 
-/* returns number of buffers available in bufs ptr */
+/* returns number of buffers available in bufs ptr (always 0 with a sink,
+ * bufs can be NULL in that case) */
 extern int dsv_enc(DSV_ENCODER *enc, DSV_FRAME *frame, DSV_BUF *bufs);
 extern void dsv_enc_end_of_stream(DSV_ENCODER *enc, DSV_BUF *bufs);
 
@@ -127,6 +274,31 @@ typedef struct {
     DSV_FRAME *ref[DSV_MAX_PYRAMID_LEVELS + 1];
     DSV_MV *mvf[DSV_MAX_PYRAMID_LEVELS + 1];
     int levels;
+    /* optional, full-pel vectors per block to try as search starting points */
+    DSV_MV *seed;
+    /* optional, final motion field of ref[0] (half-pel vectors) */
+    DSV_MV *ref_mvs;
+    /* also try the ref_mvs vectors of the co-located block and its
+     * neighbors at every level */
+    int temporal;
+    DSV_EFFORT *effort;
+    DSV_FRAME **ref_hp; /* half-pel planes of ref[0] or NULL */
+    /* per block statistics of src[0] and ref[0], anything not known yet
+     * is measured and filled in */
+    DSV_BLKSTAT *src_stats;
+    DSV_BLKSTAT *ref_stats;
+    uint8_t *statics; /* used internally, blocks found static (effort->static_skip) */
+    /* percentage of intra blocks above which the frame gets coded as an I
+     * frame instead, the search is stopped as soon as that is certain.
+     * negative to always finish */
+    int intra_thresh;
+    /* set by dsv_hme, see DSV_STATS */
+    int promoted; /* stopped early because of intra_thresh */
+    int nintra;
+    int static_blocks;
+    int hpel_searched;
+    int hpel_skipped;
+    int hpel_hits;
 } DSV_HME;
 
 extern int dsv_hme(DSV_HME *hme);
@@ -0,0 +1,341 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+#include "dsv_index.h"
+
+#include <string.h>
+#include <limits.h>
+
+/* sidecar file layout, all big endian like the stream itself:
+ *   "DSVX" version(1) size(8) end(8) n(4)
+ *   n * { fno(4) type(1) pos(8) meta(8) } */
+#define IDX_VERSION 1
+#define IDX_HDR_SIZE (4 + 1 + 8 + 8 + 4)
+#define IDX_ENT_SIZE (4 + 1 + 8 + 8)
+/* the frame number is the first thing in a picture packet */
+#define PIC_HDR_SIZE (DSV_PACKET_HDR_SIZE + 4)
+
+static uint64_t
+get_be(uint8_t *p, int n)
+{
+    uint64_t v = 0;
+
+    while (n-- > 0) {
+        v = (v << 8) | *p++;
+    }
+    return v;
+}
+
+static void
+put_be(uint8_t *p, uint64_t v, int n)
+{
+    while (n-- > 0) {
+        p[n] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+static int
+has_4cc(uint8_t *hdr)
+{
+    return hdr[0] == DSV_FOURCC_0 && hdr[1] == DSV_FOURCC_1 &&
+           hdr[2] == DSV_FOURCC_2 && hdr[3] == DSV_FOURCC_3;
+}
+
+static int
+add_entry(DSV_INDEX *x, int *cap, DSV_INDEX_ENTRY *e)
+{
+    DSV_INDEX_ENTRY *ents;
+
+    if (x->n == *cap) {
+        *cap = *cap ? *cap * 2 : 256;
+        ents = dsv_alloc(*cap * sizeof(*ents));
+        if (ents == NULL) {
+            return 0;
+        }
+        if (x->ents) {
+            memcpy(ents, x->ents, x->n * sizeof(*ents));
+            dsv_free(x->ents);
+        }
+        x->ents = ents;
+    }
+    x->ents[x->n++] = *e;
+    return 1;
+}
+
+extern int
+dsv_index_build(DSV_INDEX *x, FILE *f)
+{
+    uint8_t hdr[PIC_HDR_SIZE];
+    DSV_INDEX_ENTRY e;
+    DSV_OFF pos = 0, meta = -1, len;
+    int cap = 0, n;
+
+    memset(x, 0, sizeof(*x));
+    if (dsv_fseek(f, 0, SEEK_END) || (x->size = dsv_ftell(f)) < 0) {
+        return 0;
+    }
+    while (pos + DSV_PACKET_HDR_SIZE <= x->size) {
+        if (dsv_fseek(f, pos, SEEK_SET)) {
+            break;
+        }
+        n = fread(hdr, 1, PIC_HDR_SIZE, f);
+        if (n < DSV_PACKET_HDR_SIZE) {
+            break;
+        }
+        if (!has_4cc(hdr)) {
+            char s[DSV_OFF_STRLEN];
+
+            DSV_WARNING(("bad 4cc at %s, index stops there", dsv_off_str(pos, s)));
+            break;
+        }
+        /* B.1 Packet Header Link Offsets */
+        len = get_be(hdr + DSV_PACKET_NEXT_OFFSET, 4);
+        if (len == 0) {
+            len = DSV_PACKET_HDR_SIZE;
+        }
+        e.type = hdr[DSV_PACKET_TYPE_OFFSET];
+        if (e.type == DSV_PT_EOS || len < DSV_PACKET_HDR_SIZE || pos + len > x->size) {
+            break;
+        }
+        if (e.type == DSV_PT_META) {
+            meta = pos;
+        } else if (DSV_PT_IS_PIC(e.type) && meta >= 0 && n == PIC_HDR_SIZE) {
+            e.fno = get_be(hdr + DSV_PACKET_HDR_SIZE, 4);
+            e.pos = pos;
+            e.meta = meta;
+            if (!add_entry(x, &cap, &e)) {
+                break;
+            }
+        }
+        pos += len;
+    }
+    x->end = pos;
+    if (x->n == 0) {
+        dsv_index_free(x);
+        return 0;
+    }
+    return 1;
+}
+
+extern int
+dsv_index_save(DSV_INDEX *x, char *path)
+{
+    uint8_t b[IDX_HDR_SIZE];
+    FILE *f;
+    int i, ok;
+
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        return 0;
+    }
+    b[0] = 'D';
+    b[1] = 'S';
+    b[2] = 'V';
+    b[3] = 'X';
+    b[4] = IDX_VERSION;
+    put_be(b + 5, x->size, 8);
+    put_be(b + 13, x->end, 8);
+    put_be(b + 21, x->n, 4);
+    ok = fwrite(b, 1, IDX_HDR_SIZE, f) == IDX_HDR_SIZE;
+    for (i = 0; ok && i < x->n; i++) {
+        DSV_INDEX_ENTRY *e = &x->ents[i];
+
+        put_be(b + 0, e->fno, 4);
+        b[4] = e->type;
+        put_be(b + 5, e->pos, 8);
+        put_be(b + 13, e->meta, 8);
+        ok = fwrite(b, 1, IDX_ENT_SIZE, f) == IDX_ENT_SIZE;
+    }
+    if (fclose(f)) {
+        ok = 0;
+    }
+    if (!ok) {
+        remove(path);
+    }
+    return ok;
+}
+
+/* does the stream have the packet e says it has */
+static int
+check_entry(FILE *s, DSV_INDEX_ENTRY *e)
+{
+    uint8_t hdr[PIC_HDR_SIZE];
+
+    if (dsv_fseek(s, e->meta, SEEK_SET) ||
+        fread(hdr, 1, DSV_PACKET_HDR_SIZE, s) != DSV_PACKET_HDR_SIZE ||
+        !has_4cc(hdr) || hdr[DSV_PACKET_TYPE_OFFSET] != DSV_PT_META) {
+        return 0;
+    }
+    if (dsv_fseek(s, e->pos, SEEK_SET) ||
+        fread(hdr, 1, PIC_HDR_SIZE, s) != PIC_HDR_SIZE ||
+        !has_4cc(hdr) || hdr[DSV_PACKET_TYPE_OFFSET] != e->type) {
+        return 0;
+    }
+    return get_be(hdr + DSV_PACKET_HDR_SIZE, 4) == e->fno;
+}
+
+extern int
+dsv_index_load(DSV_INDEX *x, char *path, FILE *s)
+{
+    uint8_t b[IDX_HDR_SIZE];
+    FILE *f;
+    DSV_OFF size, fsize;
+    uint64_t n;
+    int i;
+
+    memset(x, 0, sizeof(*x));
+    if (dsv_fseek(s, 0, SEEK_END) || (size = dsv_ftell(s)) < 0) {
+        return 0;
+    }
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    if (fread(b, 1, IDX_HDR_SIZE, f) != IDX_HDR_SIZE ||
+        memcmp(b, "DSVX", 4) || b[4] != IDX_VERSION) {
+        DSV_WARNING(("%s is not a seek index", path));
+        goto fail;
+    }
+    x->size = get_be(b + 5, 8);
+    x->end = get_be(b + 13, 8);
+    n = get_be(b + 21, 4);
+    if (x->size != size) {
+        DSV_WARNING(("%s was made for a different stream", path));
+        goto fail;
+    }
+    /* the entry count has to account for the whole file before
+     * anything is allocated based on it */
+    if (dsv_fseek(f, 0, SEEK_END) || (fsize = dsv_ftell(f)) < 0 ||
+        dsv_fseek(f, IDX_HDR_SIZE, SEEK_SET)) {
+        goto fail;
+    }
+    if (n == 0 || n * IDX_ENT_SIZE != (uint64_t) (fsize - IDX_HDR_SIZE)) {
+        DSV_WARNING(("%s is damaged", path));
+        goto fail;
+    }
+    if (n > INT_MAX / sizeof(*x->ents) || x->end < 0 || x->end > size) {
+        goto fail;
+    }
+    x->n = n;
+    x->ents = dsv_alloc(x->n * sizeof(*x->ents));
+    if (x->ents == NULL) {
+        DSV_ERROR(("out of memory loading %s", path));
+        goto fail;
+    }
+    for (i = 0; i < x->n; i++) {
+        DSV_INDEX_ENTRY *e = &x->ents[i];
+
+        if (fread(b, 1, IDX_ENT_SIZE, f) != IDX_ENT_SIZE) {
+            DSV_WARNING(("%s is truncated", path));
+            goto fail;
+        }
+        e->fno = get_be(b + 0, 4);
+        e->type = b[4];
+        e->pos = get_be(b + 5, 8);
+        e->meta = get_be(b + 13, 8);
+        if (e->pos >= x->end || e->meta < 0 || e->meta >= e->pos) {
+            goto fail;
+        }
+    }
+    if (!check_entry(s, &x->ents[0]) || !check_entry(s, &x->ents[x->n - 1])) {
+        DSV_WARNING(("%s does not match the stream", path));
+        goto fail;
+    }
+    fclose(f);
+    return 1;
+fail:
+    fclose(f);
+    dsv_index_free(x);
+    return 0;
+}
+
+extern DSV_INDEX_ENTRY *
+dsv_index_find(DSV_INDEX *x, DSV_FNUM fno)
+{
+    int lo, hi, mid;
+
+    if (x->n == 0) {
+        return NULL;
+    }
+    /* last picture at or before fno */
+    lo = 0;
+    hi = x->n - 1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (x->ents[mid].fno <= fno) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    /* back to the start of its GOP */
+    while (lo > 0 && DSV_PT_HAS_REF(x->ents[lo].type)) {
+        lo--;
+    }
+    return &x->ents[lo];
+}
+
+extern int
+dsv_dec_seek(DSV_DECODER *d, FILE *f, DSV_INDEX_ENTRY *ent)
+{
+    uint8_t hdr[DSV_PACKET_HDR_SIZE];
+    DSV_BUF buf;
+    DSV_FRAME *frame;
+    DSV_FNUM fno;
+    int len, pipeline, code;
+
+    dsv_dec_free(d);
+    d->ref = NULL;
+    d->got_metadata = 0;
+    if (dsv_fseek(f, ent->meta, SEEK_SET) ||
+        fread(hdr, 1, DSV_PACKET_HDR_SIZE, f) != DSV_PACKET_HDR_SIZE ||
+        !has_4cc(hdr) || hdr[DSV_PACKET_TYPE_OFFSET] != DSV_PT_META) {
+        char s[DSV_OFF_STRLEN];
+
+        DSV_ERROR(("no metadata packet at %s", dsv_off_str(ent->meta, s)));
+        return 0;
+    }
+    len = get_be(hdr + DSV_PACKET_NEXT_OFFSET, 4);
+    if (len < DSV_PACKET_HDR_SIZE) {
+        len = DSV_PACKET_HDR_SIZE;
+    }
+    dsv_mk_buf(&buf, len);
+    memcpy(buf.data, hdr, DSV_PACKET_HDR_SIZE);
+    if (fread(buf.data + DSV_PACKET_HDR_SIZE, 1, len - DSV_PACKET_HDR_SIZE, f) !=
+        (size_t) (len - DSV_PACKET_HDR_SIZE)) {
+        dsv_buf_free(&buf);
+        return 0;
+    }
+    /* straight through, the pipeline starts again with the next packet */
+    pipeline = d->pipeline;
+    d->pipeline = 0;
+    code = dsv_dec(d, &buf, &frame, &fno);
+    d->pipeline = pipeline;
+    if (code != DSV_DEC_GOT_META) {
+        return 0;
+    }
+    return dsv_fseek(f, ent->pos, SEEK_SET) == 0;
+}
+
+extern void
+dsv_index_free(DSV_INDEX *x)
+{
+    if (x->ents) {
+        dsv_free(x->ents);
+    }
+    memset(x, 0, sizeof(*x));
+}
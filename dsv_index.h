@@ -0,0 +1,84 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+#ifndef _DSV_INDEX_H_
+#define _DSV_INDEX_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "dsv.h"
+#include "dsv_decoder.h"
+#include "platform.h"
+
+#include <stdio.h>
+
+/* Seek index
+ *
+ * maps the frame numbers of the pictures in a stream to the byte offsets of
+ * their packets so decoding can start at any frame without walking every
+ * packet before it. Streams do not carry an index, it is built by following
+ * the packet link offsets (only the headers are read) and can be saved
+ * next to the stream as a sidecar file.
+ *
+ * To start decoding at frame fno, look up the entry with dsv_index_find,
+ * get the decoder there with dsv_dec_seek and decode the packets from
+ * ent->pos onward, dropping the frames before fno.
+ */
+
+typedef struct {
+    DSV_FNUM fno;
+    int type; /* packet type */
+    DSV_OFF pos; /* offset of the picture packet */
+    DSV_OFF meta; /* offset of the metadata packet in effect */
+} DSV_INDEX_ENTRY;
+
+typedef struct {
+    DSV_OFF size; /* of the stream, to tell if a saved index is out of date */
+    DSV_OFF end; /* offset just past the last complete packet before EOS */
+    int n;
+    DSV_INDEX_ENTRY *ents; /* every picture, in stream order */
+} DSV_INDEX;
+
+/* returns 0 if f is not seekable or has no pictures */
+extern int dsv_index_build(DSV_INDEX *x, FILE *f);
+
+/* returns 0 on failure */
+extern int dsv_index_save(DSV_INDEX *x, char *path);
+
+/* returns 0 if the file is missing, damaged or does not match the stream
+ * in f (different size, or the packets it points to are not there) */
+extern int dsv_index_load(DSV_INDEX *x, char *path, FILE *f);
+
+/* entry of the intra picture decoding has to start from to get frame fno,
+ * or the first picture if fno is before it. frame numbers have to
+ * increase through the stream (which they do unless streams were
+ * concatenated) */
+extern DSV_INDEX_ENTRY *dsv_index_find(DSV_INDEX *x, DSV_FNUM fno);
+
+extern void dsv_index_free(DSV_INDEX *x);
+
+/* drop whatever the decoder was in the middle of, give it the metadata
+ * packet in effect at ent and leave f at the packet of ent. the user set
+ * fields of the decoder are kept. returns 0 if the packets are not there */
+extern int dsv_dec_seek(DSV_DECODER *d, FILE *f, DSV_INDEX_ENTRY *ent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -94,9 +94,12 @@ extern int dsv_bs_get_rle(DSV_ZBRLE *rle);
 extern int dsv_get_quant(int q, int isP, int level);
 
 extern void dsv_fwd_sbt(DSV_PLANE *src, DSV_COEFS *dst, int isP);
-extern void dsv_inv_sbt(DSV_PLANE *dst, DSV_COEFS *src, int q, int isP, int c);
+/* dst is 1 / (1 << scale) of the size of src, the levels above that are
+ * not inverted (see DSV_PARAMS scale) */
+extern void dsv_inv_sbt(DSV_PLANE *dst, DSV_COEFS *src, int q, int isP, int c, int scale);
 
 extern void dsv_encode_plane(DSV_BS *bs, DSV_COEFS *src, int q, DSV_STABILITY *stab);
+/* stops before the levels that are not needed at stab->params->scale */
 extern void dsv_decode_plane(uint8_t *in, unsigned s, DSV_COEFS *dst, int q, DSV_STABILITY *stab);
 
 extern int dsv_lb2(unsigned n);
@@ -105,8 +108,21 @@ extern void dsv_movec_pred(DSV_MV *vecs, DSV_PARAMS *p, int x, int y, int *px, i
 
 #define DSV_HP_COEF 9
 
-extern void dsv_sub_pred(DSV_MV *vecs, DSV_PARAMS *p, DSV_FRAME *dif, DSV_FRAME *inp, DSV_FRAME *ref);
-extern void dsv_add_pred(DSV_MV *vecs, DSV_PARAMS *p, DSV_FRAME *dif, DSV_FRAME *out, DSV_FRAME *ref);
+/* how far out from the frame edges the half-pel planes are filled in */
+#define DSV_HP_BORDER (DSV_FRAME_BORDER - 2)
+/* build the half-pel planes (bit i = hp[i]) of an extended reference frame
+ * that are in 'phases' and not built yet. only the first 'nplanes' planes
+ * (luma, then chroma) are filled in */
+extern void dsv_hpel_planes(DSV_FRAME *ref, DSV_FRAME **hp, int nplanes, int phases);
+/* the half-pel planes needed to compensate with these vectors */
+extern int dsv_hpel_phases(DSV_MV *vecs, DSV_PARAMS *p);
+extern void dsv_hpel_planes_free(DSV_FRAME **hp);
+
+/* hp = half-pel planes of ref or NULL to interpolate block by block.
+ * dsv_add_pred splits the rows of blocks over nthreads threads (see
+ * dsv_parallel), the output is the same for any number */
+extern void dsv_sub_pred(DSV_MV *vecs, DSV_PARAMS *p, DSV_FRAME *dif, DSV_FRAME *inp, DSV_FRAME *ref, DSV_FRAME **hp);
+extern void dsv_add_pred(DSV_MV *vecs, DSV_PARAMS *p, DSV_FRAME *dif, DSV_FRAME *out, DSV_FRAME *ref, DSV_FRAME **hp, int nthreads);
 
 #ifdef __cplusplus
 }
@@ -17,7 +17,11 @@
 #include "dsv.h"
 #include "dsv_encoder.h"
 #include "dsv_decoder.h"
+#include "dsv_index.h"
 #include "util.h"
+#include "yuv.h"
+#include "platform.h"
+#include "synth.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -29,6 +33,7 @@
                     DSV_VERSION_MINOR
 
 static int encoding = 0;
+static int benching = 0; /* also sets encoding */
 static char *progname = NULL;
 static int dooverwrite = 1;
 static int verbose = 0;
@@ -43,6 +48,8 @@ static int verbose = 0;
 
 #define AUTO_BITRATE 0
 
+#define MAX_RUNGS 2 /* lower resolutions in a ladder */
+
 static int
 pct_to_qual(int v)
 {
@@ -118,10 +125,16 @@ static struct PARAM enc_params[] = {
             "percentage threshold of intra blocks in an inter frame after which it is simply made into an intra frame. 50 = default" },
     { "pyrlevels", 0, 0, DSV_MAX_PYRAMID_LEVELS, NULL,
             "number of pyramid levels to use in hierarchical motion estimation. 0 means auto-determine. 0 = default" },
+    { "preset", DSV_PRESET_SLOW, DSV_PRESET_ULTRAFAST, DSV_PRESET_SLOW, NULL,
+            "speed preset. 0 = ultrafast, 1 = fast, 2 = medium, 3 = slow. Faster presets search less for motion and intra blocks. 3 = default" },
+    { "realtime", 0, 0, 1000, NULL,
+            "real-time mode. Each frame should take at most this percent of the frame interval (1 / fps), the preset is lowered for as long as needed to keep up. 0 = off, 0 = default" },
     { "rc_mode", DSV_RATE_CONTROL_ABR, RC_CRF, RC_ABR, rc_to_rc,
             "rate control mode. 0 = single pass average bitrate (ABR), 1 = constant rate factor (CRF). 0 = default" },
     { "rc_hmnudge", 1, 0, 1, NULL,
             "nudge the rate control loop a bit harder in high motion scenes. 1 = default" },
+    { "rc_gop", 0, 0, 1, NULL,
+            "ONLY FOR ABR RATE CONTROL: give every GOP its own byte budget instead of steering towards the average of all frames so far. GOPs then do not depend on how much earlier ones spent, but the overall bitrate is less accurate. 0 = default" },
     { "kbps", AUTO_BITRATE, AUTO_BITRATE, INT_MAX, to_bps,
             "ONLY FOR ABR RATE CONTROL: bitrate in kilobits per second. 0 = auto-estimate needed bitrate for desired qp. 0 = default" },
     { "maxqstep", DSV_MAX_QUALITY * 1 / 200, 1, DSV_MAX_QUALITY, NULL,
@@ -138,6 +151,18 @@ static struct PARAM enc_params[] = {
             "do scene change detection. 1 = default" },
     { "schdelta", 4, 0, 256, NULL,
             "scene change average luma delta threshold. Units are 8-bit luma. 4 = default" },
+    { "jobs", 1, 1, 256, NULL,
+            "number of GOPs to encode at the same time, each with its own encoder. Rate control carries over from one round of GOPs to the next, so the bitrate stays close to the target but the output is not the same as with one job. 1 = default" },
+    { "rungs", 0, 0, MAX_RUNGS, NULL,
+            "also encode the video at lower resolutions in the same pass. 1 = half, 2 = half and quarter. Saved next to the output file with _half / _quarter added to its name. 0 = default" },
+    { "temporal", 0, 0, 1, NULL,
+            "also start the motion search from the motion vectors of the previous frame, with one pyramid level less. 0 = default" },
+    { "cachehp", 0, 0, 1, NULL,
+            "interpolate whole reference frames to half-pel instead of block by block. Uses more memory and is usually slower since each reference frame is only predicted from once, same output. 0 = default" },
+    { "synth", SYNTH_NONE, SYNTH_NONE, SYNTH_NPATTERNS - 1, NULL,
+            "generate the input instead of reading -inp_. 1 = moving gradients, 2 = panning texture, 3 = noise, 4 = scene cuts, 5 = screen content, 6 = all of them. The sequence is -nfr frames long (300 if -1). 0 = default" },
+    { "index", 0, 0, 1, NULL,
+            "also save a seek index next to each output file (with .idx added to its name) so decoding can start at any frame without reading the stream before it. 0 = default" },
     { NULL, 0, 0, 0, NULL, "" }
 };
 
@@ -146,14 +171,36 @@ static struct PARAM dec_params[] = {
             "convert video to 4:2:0 chroma subsampling before saving output. 0 = default" },
     { "drawinfo", 0, 0, (DSV_DRAW_STABHQ | DSV_DRAW_MOVECS | DSV_DRAW_IBLOCK), NULL,
             "draw debugging information on the decoded frames (bit OR together to get multiple at the same time):\n\t\t1 = draw stability info\n\t\t2 = draw motion vectors\n\t\t4 = draw intra subblocks. 0 = default" },
+    { "cachehp", 0, 0, 1, NULL,
+            "interpolate whole reference frames to half-pel instead of block by block. Uses more memory and is usually slower since each reference frame is only predicted from once, same output. 0 = default" },
+    { "threads", 1, 1, 256, NULL,
+            "number of threads to split motion compensation over (needs DSV_MT), same output. 1 = default" },
+    { "pipeline", 0, 0, 16, NULL,
+            "number of pictures to entropy decode and inverse transform ahead on a separate thread while earlier ones are motion compensated (needs DSV_MT), same output. 0 = default" },
+    { "jobs", 1, 1, 256, NULL,
+            "number of GOPs to decode at the same time, each with its own decoder (needs DSV_MT and an output file), same output. 1 = default" },
+    { "sfr", 0, 0, INT_MAX, NULL,
+            "frame number to start decoding at. Decoding starts at the intra picture before it, found through the seek index. 0 = default" },
+    { "nfr", -1, -1, INT_MAX, NULL,
+            "number of frames to decode. -1 means as many as possible. -1 = default" },
+    { "index", 0, 0, 1, NULL,
+            "save a seek index next to the input file (with .idx added to its name) unless it already has one. 0 = default" },
+    { "scale", 0, 0, DSV_MAX_SCALE, NULL,
+            "decode at a lower resolution straight from the lower subbands, skipping the work for the highest ones. 1 = half, 2 = quarter. Predicted frames drift slightly from a downscaled full decode until the next intra frame. 0 = default" },
     { NULL, 0, 0, 0, NULL, "" }
 };
 
 static struct {
     char *inp; /* input file path */
     char *out; /* output file path */
+    char *stats; /* statistics output path */
 } opts;
 
+static struct {
+    char *base; /* results of an earlier run to compare against */
+    int tol;
+} bench_opts = { NULL, 10 };
+
 static int
 get_optval(struct PARAM *pars, char *name)
 {
@@ -173,9 +220,10 @@ usage_general(void)
     char *p = progname;
     
     printf(DRV_HEADER);
-    printf("usage: %s <e|d> [options]\n", p);
+    printf("usage: %s <e|d|bench> [options]\n", p);
     printf("for more information about running the encoder: %s e help\n", p);
     printf("for more information about running the decoder: %s d help\n", p);
+    printf("for more information about running the benchmark: %s bench help\n", p);
 }
 
 static void
@@ -190,8 +238,13 @@ print_params(struct PARAM *pars)
         printf("\t-%s : %s\n", par->prefix, par->desc);
         printf("\t      [min = %d, max = %d]\n", par->min, par->max);
     }
-    printf("\t-inp_ : REQUIRED! input file\n");
-    printf("\t-out_ : REQUIRED! output file\n");
+    printf("\t-inp_ : REQUIRED! input file%s\n", encoding ? ", - = read from stdin (not needed with -synth)" : "");
+    printf("\t-out_ : REQUIRED! output file%s\n", (encoding && !benching) ? "" : ", - = write to stdout");
+    if (benching) {
+        printf("\t-base_ : results of an earlier benchmark to compare against\n");
+        printf("\t-tol<n> : percent slower than the base that counts as a regression. 10 = default\n");
+    }
+    printf("\t-stats_ : write statistics (time per stage, frame latency, bytes per plane, ...) as JSON to this file, - = stderr\n");
     printf("\t-y : do not prompt for confirmation when potentially overwriting an existing file\n");
     printf("\t-l<n> : set logging level to n (0 = none, 1 = error, 2 = warning, 3 = info, 4 = debug/all)\n");
     printf("\t-v : set verbose\n");
@@ -219,10 +272,24 @@ usage_decoder(void)
     print_params(dec_params);
 }
 
+static void
+usage_bench(void)
+{
+    char *p = progname;
+    
+    printf(DRV_HEADER);
+    printf("usage: %s bench [encoder options] [-base_<file>] [-tol<n>]\n", p);
+    printf("encodes and decodes the input in memory, writes the time taken by each stage as JSON\n");
+    printf("sample usage: %s bench -inp_video.yuv -out_results.json -w352 -h288 -base_old_results.json\n", p);
+    print_params(enc_params);
+}
+
 static void
 usage(void)
 {
-    if (encoding) {
+    if (benching) {
+        usage_bench();
+    } else if (encoding) {
         usage_encoder();
     } else {
         usage_decoder();
@@ -332,6 +399,22 @@ get_param(char *argv)
         opts.out = p;
         return 1;
     }
+    if (prefixcmp("stats_", &p)) {
+        opts.stats = p;
+        return 1;
+    }
+    if (benching && prefixcmp("base_", &p)) {
+        bench_opts.base = p;
+        return 1;
+    }
+    if (benching && prefixcmp("tol", &p)) {
+        bench_opts.tol = stoint(p, &err);
+        if (err || bench_opts.tol < 0) {
+            printf("error reading argument: tol\n");
+            return 0;
+        }
+        return 1;
+    }
 
     if (encoding) {
         params = enc_params;
@@ -379,8 +462,22 @@ init_params(int argc, char **argv)
     return 1;
 }
 
-static uint8_t *enc_buf = NULL;
-static unsigned bufsz = 0;
+/* the encoded packets of a stream (or a piece of one), the encoder writes
+ * its packets directly into the end of the buffer through its sink.
+ * with fp set (see stream_open) every packet goes on to the file as soon as
+ * it is done and the buffer only ever holds the one being encoded */
+struct STREAM {
+    uint8_t *data;
+    unsigned len, cap;
+    int has_pic;
+    unsigned first_pic; /* offset of the first picture packet in data */
+    unsigned last_pic_len;
+    FILE *fp;
+    int error; /* writing to fp failed */
+    unsigned long total; /* bytes emitted */
+};
+
+static struct STREAM output;
 
 static uint8_t *
 mrealloc(uint8_t *p, unsigned sz)
@@ -391,101 +488,624 @@ mrealloc(uint8_t *p, unsigned sz)
     return realloc(p, sz);
 }
 
+static uint8_t *
+stream_acquire(void *user, unsigned size)
+{
+    struct STREAM *s = user;
+    uint8_t *p;
+
+    if (s->len + size > s->cap) {
+        p = mrealloc(s->data, (s->len + size) * 2);
+        if (p == NULL) {
+            return NULL;
+        }
+        s->data = p;
+        s->cap = (s->len + size) * 2;
+    }
+    return s->data + s->len;
+}
+
 static void
-savebuffer(DSV_BUF *buffer)
+stream_emit(void *user, uint8_t *data, unsigned len)
 {
-    enc_buf = mrealloc(enc_buf, bufsz + buffer->len);
-    memcpy(enc_buf + bufsz, buffer->data, buffer->len);
-    bufsz += buffer->len;
+    struct STREAM *s = user;
+
+    s->total += len;
+    if (s->fp) {
+        if (fwrite(data, 1, len, s->fp) != len) {
+            s->error = 1;
+        }
+        return;
+    }
+    if (data != s->data + s->len) {
+        /* not written in place, copy it in */
+        if (stream_acquire(s, len) == NULL) {
+            DSV_ERROR(("out of memory, packet dropped"));
+            return;
+        }
+        memcpy(s->data + s->len, data, len);
+    }
+    if (DSV_PT_IS_PIC(s->data[s->len + DSV_PACKET_TYPE_OFFSET])) {
+        if (!s->has_pic) {
+            s->first_pic = s->len;
+            s->has_pic = 1;
+        }
+        s->last_pic_len = len;
+    }
+    s->len += len;
+}
+
+static void
+stream_sink(DSV_ENCODER *enc, struct STREAM *s)
+{
+    DSV_SINK sink;
+
+    sink.user = s;
+    sink.acquire = stream_acquire;
+    sink.emit = stream_emit;
+    dsv_enc_set_sink(enc, &sink);
 }
 
 static int
-writefile(char *n, unsigned char *buf, long len)
+stream_open(struct STREAM *s, char *path)
 {
-    FILE *fp = fopen(n, "wb");
-    if (fp == NULL) {
+    memset(s, 0, sizeof(*s));
+    s->fp = fopen(path, "wb");
+    if (s->fp == NULL) {
         perror("unable to open file");
         return 0;
     }
+    return 1;
+}
+
+/* returns 0 if the file could not be written */
+static int
+stream_close(struct STREAM *s)
+{
+    int ok = !s->error;
+
+    if (s->fp && fclose(s->fp)) {
+        ok = 0;
+    }
+    if (s->data) {
+        free(s->data);
+    }
+    memset(s, 0, sizeof(*s));
+    return ok;
+}
 
-    if (fwrite(buf, 1, len, fp) != (unsigned) len) {
-        perror("unable to write file");
-        goto err;
+static char *
+input_name(void)
+{
+    static char name[32];
+    int synth = get_optval(enc_params, "synth");
+    
+    if (encoding && synth != SYNTH_NONE) {
+        sprintf(name, "synthetic %s", synth_name(synth));
+        return name;
     }
+    return opts.inp;
+}
+
+static int
+open_input(YUV_READER *r, DSV_META *md)
+{
+    int synth = get_optval(enc_params, "synth");
+    long len;
     
-    fclose(fp);
+    if (synth != SYNTH_NONE) {
+        len = get_optval(enc_params, "nfr");
+        if (len < 0) {
+            len = SYNTH_DEFAULT_LEN;
+        }
+        len += get_optval(enc_params, "sfr");
+        return yuv_open_synth(r, synth, len, md->width, md->height, md->subsamp);
+    }
+    return yuv_open_reader(r, opts.inp, md->width, md->height, md->subsamp);
+}
+
+static void
+setup_meta(DSV_META *md)
+{
+    md->width = get_optval(enc_params, "w");
+    md->height = get_optval(enc_params, "h");
+    md->subsamp = get_optval(enc_params, "fmt");
+    md->fps_num = get_optval(enc_params, "fps_num");
+    md->fps_den = get_optval(enc_params, "fps_den");
+    md->aspect_num = get_optval(enc_params, "aspect_num");
+    md->aspect_den = get_optval(enc_params, "aspect_den");
+}
+
+static void
+setup_encoder(DSV_ENCODER *enc, DSV_META *md)
+{
+    int spec_bps, rt;
+
+    dsv_enc_init(enc);
+    dsv_enc_set_metadata(enc, md);
+    enc->stats.enabled = (opts.stats != NULL);
+
+    enc->gop = get_optval(enc_params, "gop");
+
+    enc->scene_change_delta = get_optval(enc_params, "schdelta");
+    enc->do_scd = get_optval(enc_params, "scd");
+    enc->intra_pct_thresh = get_optval(enc_params, "ipct");
+    enc->quality = get_optval(enc_params, "qp");
+    enc->rc_mode = get_optval(enc_params, "rc_mode");
+    spec_bps = get_optval(enc_params, "kbps");
+    if (spec_bps == AUTO_BITRATE) {
+        enc->bitrate = estimate_bitrate(enc->quality * 100 / DSV_MAX_QUALITY, enc->gop, md);
+    } else {
+        enc->bitrate = spec_bps;
+    }
+    if (enc->rc_mode == DSV_RATE_CONTROL_ABR) {
+        enc->quality = CLAMP(enc->quality * 3 / 2, 0, DSV_MAX_QUALITY);
+    }
+    enc->max_q_step = get_optval(enc_params, "maxqstep");
+    enc->min_quality = get_optval(enc_params, "minqp");
+    enc->max_quality = get_optval(enc_params, "maxqp");
+    enc->min_I_frame_quality = get_optval(enc_params, "iminqp");
+
+    enc->rc_high_motion_nudge = get_optval(enc_params, "rc_hmnudge");
+    enc->gop_budgets = get_optval(enc_params, "rc_gop");
+    enc->pyramid_levels = get_optval(enc_params, "pyrlevels");
+    enc->preset = get_optval(enc_params, "preset");
+    enc->hpel_planes = get_optval(enc_params, "cachehp");
+    enc->temporal_mvs = get_optval(enc_params, "temporal");
+    rt = get_optval(enc_params, "realtime");
+    if (rt) {
+        /* rt percent of the frame interval in usec, at most 1e7 * 2^24 */
+        enc->deadline = (unsigned) MIN((uint64_t) (1000000 / 100) * rt * md->fps_den / md->fps_num, UINT_MAX);
+    }
+    enc->stable_refresh = get_optval(enc_params, "stabref");
+    if (enc->stable_refresh == 0) {
+        enc->stable_refresh = CLAMP(enc->gop - 1, 1, 14);
+    }
+}
+
+/* Statistics */
+
+static char *stage_names[DSV_NUM_STAGES] = {
+    "pyramid", "hme", "mc", "fwd_sbt", "inv_sbt", "hzcc", "stab", "motion", "bits", "io"
+};
+
+static void
+json_string(FILE *f, char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', f);
+        }
+        if ((unsigned char) *s >= ' ') {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/* n / d in hundredths of a percent, printed as "%lu.%02lu" */
+static unsigned long
+hundredths(unsigned long n, unsigned long d)
+{
+    return d ? (unsigned long) ((uint64_t) n * 10000 / d) : 0;
+}
+
+/* deadline = 0 if there was none */
+static void
+stats_section(FILE *f, char *section, DSV_STATS *s, unsigned deadline, int last)
+{
+    unsigned long intra_pct = hundredths(s->intra_blocks, s->blocks);
+    int i;
+    
+    fprintf(f, "  \"%s\": {\n    \"frames\": %lu,\n    \"stages\": {\n", section, s->frames);
+    for (i = 0; i < DSV_NUM_STAGES; i++) {
+        fprintf(f, "      \"%s\": { \"usec\": %lu, \"calls\": %lu }%s\n", stage_names[i],
+                s->usec[i], s->calls[i], i == DSV_NUM_STAGES - 1 ? "" : ",");
+    }
+    fprintf(f, "    },\n");
+    fprintf(f, "    \"latency_usec\": { \"p50\": %lu, \"p95\": %lu, \"p99\": %lu, \"max\": %lu },\n",
+            dsv_stats_latency(s, 50), dsv_stats_latency(s, 95),
+            dsv_stats_latency(s, 99), s->latency_max);
+    fprintf(f, "    \"bytes\": { \"y\": %lu, \"u\": %lu, \"v\": %lu, \"other\": %lu },\n",
+            s->plane_bytes[0], s->plane_bytes[1], s->plane_bytes[2], s->hdr_bytes);
+    fprintf(f, "    \"inter_blocks\": %lu,\n    \"intra_blocks\": %lu,\n    \"intra_pct\": %lu.%02lu",
+            s->blocks, s->intra_blocks, intra_pct / 100, intra_pct % 100);
+    if (s->hpel_searched || s->hpel_skipped) {
+        fprintf(f, ",\n    \"hpel\": { \"searched\": %lu, \"skipped\": %lu, \"hits\": %lu }",
+                s->hpel_searched, s->hpel_skipped, s->hpel_hits);
+    }
+    if (s->static_blocks) {
+        fprintf(f, ",\n    \"static_blocks\": %lu", s->static_blocks);
+    }
+    if (deadline) {
+        unsigned long missed = hundredths(s->deadline_misses, s->frames);
+
+        fprintf(f, ",\n    \"deadline\": { \"usec\": %u, \"missed\": %lu, \"missed_pct\": %lu.%02lu, "
+                "\"effort_drops\": %lu, \"effort_raises\": %lu }",
+                deadline, s->deadline_misses, missed / 100, missed % 100,
+                s->effort_drops, s->effort_raises);
+    }
+    fprintf(f, "\n  }%s\n", last ? "" : ",");
+}
+
+/* memory use is process wide, frame_peak is whatever the last frame needed */
+static void
+memory_section(FILE *f)
+{
+    DSV_MEMUSE u[DSV_MEM_NTAGS + 1];
+    int i;
+    
+    dsv_memory_usage(u);
+    fprintf(f, "  \"memory\": {\n");
+    for (i = 0; i <= DSV_MEM_NTAGS; i++) {
+        fprintf(f, "    \"%s\": { \"allocs\": %lu, \"peak\": %lu, \"at_total_peak\": %lu, "
+                "\"last_frame_peak\": %lu, \"in_use\": %lu }%s\n",
+                dsv_memory_tag_name(i), u[i].allocs, u[i].peak, u[i].at_peak,
+                u[i].frame_peak, u[i].cur, i == DSV_MEM_NTAGS ? "" : ",");
+    }
+    fprintf(f, "  }\n");
+}
+
+/* either can be NULL */
+static void
+write_stats(DSV_ENCODER *enc, DSV_STATS *dec)
+{
+    FILE *f = stderr;
+    
+    if (opts.stats == NULL) {
+        return;
+    }
+    if (strcmp(opts.stats, "-") != 0 && (f = fopen(opts.stats, "w")) == NULL) {
+        perror("unable to open statistics file");
+        return;
+    }
+    fprintf(f, "{\n  \"input\": ");
+    json_string(f, encoding ? input_name() : opts.inp);
+    fprintf(f, ",\n");
+    if (enc) {
+        stats_section(f, "encode", &enc->stats, enc->deadline, 0);
+    }
+    if (dec) {
+        stats_section(f, "decode", dec, 0, 0);
+    }
+    memory_section(f);
+    fprintf(f, "}\n");
+    if (f != stderr) {
+        fclose(f);
+    }
+}
+
+/* GOP parallel encoding
+ *
+ * GOPs are closed so the input can be split up at GOP boundaries and each
+ * piece encoded by its own encoder. The pieces are then spliced together
+ * in order, only the link offset of the first picture in each piece has to
+ * be fixed up.
+ *
+ * A fresh encoder spends its first GOPs finding the quality that meets the
+ * bitrate, so rate control is carried over instead of starting over in
+ * every piece. The first piece is encoded on its own, after that the pieces
+ * are encoded in rounds of one per job. All pieces of a round continue
+ * from the same rate control state, which is then moved on by each of them
+ * in order (dsv_enc_join_rc) as if they had been encoded one after the
+ * other. This way the output does not depend on the timing of the threads.
+ */
+#define INTRA_CHUNK_LEN 32 /* frames per piece when encoding intra only */
+
+struct CHUNK {
+    unsigned start; /* first input frame */
+    int nfr;
+    struct STREAM out;
+    DSV_ENCODER end; /* the encoder after it finished, for its rate control */
+};
+
+struct GOP_JOBS {
+    DSV_META *md;
+    unsigned sfr;
+    struct CHUNK *chunks;
+    int nchunks;
+    int round; /* first piece of the current round */
+    int done;
+    DSV_ENCODER rc; /* rate control the current round continues from */
+    DSV_MUTEX *lock;
+    DSV_STATS stats; /* of all the encoders together */
+};
+
+/* rate control continues from 'from' (NULL = start over), the finished
+ * encoder is left in 'end' to continue from in the next piece */
+static void
+encode_chunk(struct GOP_JOBS *gj, YUV_READER *reader, struct CHUNK *c, DSV_ENCODER *from, DSV_ENCODER *end)
+{
+    DSV_ENCODER enc;
+    DSV_FRAME *frame;
+    int n;
+
+    setup_encoder(&enc, gj->md);
+    stream_sink(&enc, &c->out);
+    enc.next_fnum = c->start - gj->sfr;
+    dsv_enc_start(&enc);
+    if (from) {
+        dsv_enc_continue_rc(&enc, from);
+    }
+    for (n = 0; n < c->nfr; n++) {
+        frame = yuv_read_frame(reader, c->start + n);
+        if (frame == NULL) {
+            DSV_ERROR(("failed to read frame %d", c->start + n));
+            c->nfr = n;
+            break;
+        }
+        dsv_enc(&enc, frame, NULL);
+    }
+    dsv_mutex_lock(gj->lock);
+    dsv_stats_add(&gj->stats, &enc.stats);
+    if (verbose) {
+        printf("encoded GOP %d/%d\r", ++gj->done, gj->nchunks);
+        fflush(stdout);
+    }
+    dsv_mutex_unlock(gj->lock);
+    dsv_enc_free(&enc);
+    /* the buffers are freed and cleared above, drop the sink too so that
+     * 'end' only carries the rate control state and points to nothing */
+    memset(&enc.sink, 0, sizeof(enc.sink));
+    enc.has_sink = 0;
+    *end = enc;
+}
+
+static void
+gop_worker(void *arg, int idx)
+{
+    struct GOP_JOBS *gj = arg;
+    struct CHUNK *c = &gj->chunks[gj->round + idx];
+    YUV_READER reader;
+
+    /* every worker reads the frames it needs on its own */
+    if (!open_input(&reader, gj->md)) {
+        DSV_ERROR(("worker %d could not open input %s", idx, input_name()));
+        c->nfr = 0;
+        return;
+    }
+    DSV_INFO(("worker %d encoding frames %u to %u", idx, c->start, c->start + c->nfr - 1));
+    encode_chunk(gj, &reader, c, &gj->rc, &c->end);
+    yuv_close_reader(&reader);
+}
+
+/* returns number of frames encoded, their statistics are added to stats.
+ * the first piece is read from 'reader' */
+static unsigned
+encode_gops(DSV_META *md, YUV_READER *reader, unsigned sfr, unsigned nfr, int chunklen, int jobs, DSV_STATS *stats)
+{
+    struct GOP_JOBS gj;
+    DSV_ENCODER eos, rc;
+    DSV_BUF buf;
+    unsigned f, total = 0, prev_link = 0;
+    int i, n, ended = 0;
+
+    memset(&gj, 0, sizeof(gj));
+    gj.md = md;
+    gj.sfr = sfr;
+    gj.nchunks = (nfr + chunklen - 1) / chunklen;
+    gj.chunks = calloc(gj.nchunks + 1, sizeof(*gj.chunks));
+    if (gj.chunks == NULL) {
+        DSV_ERROR(("out of memory"));
+        return 0;
+    }
+    gj.lock = dsv_mutex_new();
+    for (i = 0, f = 0; i < gj.nchunks; i++, f += chunklen) {
+        gj.chunks[i].start = sfr + f;
+        gj.chunks[i].nfr = MIN((unsigned) chunklen, nfr - f);
+    }
+    DSV_INFO(("encoding %d GOPs with %d jobs", gj.nchunks, jobs));
+    encode_chunk(&gj, reader, &gj.chunks[0], NULL, &gj.chunks[0].end);
+    gj.rc = gj.chunks[0].end;
+    for (gj.round = 1; gj.round < gj.nchunks; gj.round += n) {
+        n = MIN(jobs, gj.nchunks - gj.round);
+        dsv_parallel(n, gop_worker, &gj);
+        rc = gj.rc;
+        for (i = gj.round; i < gj.round + n; i++) {
+            dsv_enc_join_rc(&rc, &gj.rc, &gj.chunks[i].end);
+        }
+        gj.rc = rc;
+    }
+    dsv_mutex_free(gj.lock);
+    dsv_stats_add(stats, &gj.stats);
+
+    for (i = 0; i < gj.nchunks; i++) {
+        struct STREAM *s = &gj.chunks[i].out;
+
+        if (!ended) {
+            if (s->has_pic) {
+                dsv_set_prev_link(s->data + s->first_pic, prev_link);
+                prev_link = s->last_pic_len;
+            }
+            if (s->len) {
+                stream_emit(&output, s->data, s->len);
+            }
+            total += gj.chunks[i].nfr;
+            /* input ended early, later GOPs could not be read either */
+            ended = gj.chunks[i].nfr < chunklen;
+        }
+        if (s->data) {
+            free(s->data);
+        }
+    }
+    free(gj.chunks);
+
+    dsv_enc_init(&eos);
+    dsv_enc_end_of_stream(&eos, &buf);
+    dsv_set_prev_link(buf.data, prev_link);
+    stream_emit(&output, buf.data, buf.len);
+    dsv_buf_free(&buf);
+    dsv_enc_free(&eos);
+    return total;
+}
+
+/* output path for a ladder rung, video.dsv -> video_half.dsv */
+static char *
+rung_path(char *path, int rung)
+{
+    static char *names[MAX_RUNGS] = { "_half", "_quarter" };
+    char *dot, *slash, *out;
+    size_t base;
+    
+    out = malloc(strlen(path) + strlen(names[rung]) + 1);
+    if (out == NULL) {
+        return NULL;
+    }
+    dot = strrchr(path, '.');
+    slash = strrchr(path, '/');
+    base = strlen(path);
+    if (dot && (slash == NULL || dot > slash)) {
+        base = dot - path;
+    }
+    memcpy(out, path, base);
+    strcpy(out + base, names[rung]);
+    strcat(out, path + base);
+    return out;
+}
+
+/* sidecar seek index of a stream, video.dsv -> video.dsv.idx */
+static char *
+index_path(char *path)
+{
+    char *out;
+
+    out = malloc(strlen(path) + 5);
+    if (out) {
+        strcpy(out, path);
+        strcat(out, ".idx");
+    }
+    return out;
+}
+
+/* save the seek index of the stream at path next to it */
+static void
+save_index(DSV_INDEX *x, char *path)
+{
+    char *ipath;
+
+    ipath = index_path(path);
+    if (ipath && dsv_index_save(x, ipath)) {
+        if (verbose) {
+            printf("saved seek index %s\n", ipath);
+        }
+    } else {
+        DSV_ERROR(("failed to write seek index for %s", path));
+    }
+    if (ipath) {
+        free(ipath);
+    }
+}
+
+/* build and save the seek index of a stream that was just written */
+static void
+write_index(char *path)
+{
+    DSV_INDEX x;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        DSV_ERROR(("could not reopen %s to index it", path));
+        return;
+    }
+    if (dsv_index_build(&x, f)) {
+        save_index(&x, path);
+        dsv_index_free(&x);
+    }
+    fclose(f);
+}
+
+/* seek index of the open stream f (saved at path), loaded from its sidecar
+ * file if that matches the stream, built otherwise and saved if 'save' */
+static int
+get_index(DSV_INDEX *x, FILE *f, char *path, int save)
+{
+    char *ipath;
+    int ok;
+
+    ipath = index_path(path);
+    ok = ipath && dsv_index_load(x, ipath, f);
+    if (ipath) {
+        free(ipath);
+    }
+    if (ok) {
+        DSV_INFO(("using the seek index of %s", path));
+        return 1;
+    }
+    if (!dsv_index_build(x, f)) {
+        return 0;
+    }
+    if (save) {
+        save_index(x, path);
+    }
     return 1;
-err:
-    fclose(fp);
-    return 0;
 }
 
 static int
 encode(void)
 {
-    uint8_t *picture;
-    DSV_BUF bufs[4];
     DSV_FRAME *frame;
     DSV_META md;
     DSV_ENCODER enc;
-    int i, run, spec_bps;
-    int w, h, fps;
+    DSV_META rung_md[MAX_RUNGS];
+    DSV_ENCODER rungs[MAX_RUNGS];
+    struct STREAM rung_out[MAX_RUNGS];
+    char *rung_paths[MAX_RUNGS];
+    int nrungs, k;
+    int run, jobs;
+    int fps;
     int maxframe;
-    FILE *inpfile;
+    YUV_READER reader;
     unsigned frno = 0;
     int nfr;
 
-    w = get_optval(enc_params, "w");
-    h = get_optval(enc_params, "h");
-    dsv_enc_init(&enc);
-
-    md.width = w;
-    md.height = h;
-    
-    md.subsamp = get_optval(enc_params, "fmt");
-    md.fps_num = get_optval(enc_params, "fps_num");
-    md.fps_den = get_optval(enc_params, "fps_den");
-    md.aspect_num = get_optval(enc_params, "aspect_num");
-    md.aspect_den = get_optval(enc_params, "aspect_den");
+    setup_meta(&md);
     
-    inpfile = fopen(opts.inp, "rb");
-    if (inpfile == NULL) {
-        printf("error opening input file %s\n", opts.inp);
+    if (!open_input(&reader, &md)) {
+        printf("error opening input %s\n", input_name());
         return EXIT_FAILURE;
     }
     fps = (md.fps_num + md.fps_den / 2) / md.fps_den;
 
-    dsv_enc_set_metadata(&enc, &md);
-
-#define EXTRA_PAD 1
-    picture = malloc(w * h * (3 + EXTRA_PAD)); /* allocate extra to be safe */
-
-    enc.gop = get_optval(enc_params, "gop");
-
-    enc.scene_change_delta = get_optval(enc_params, "schdelta");
-    enc.do_scd = get_optval(enc_params, "scd");
-    enc.intra_pct_thresh = get_optval(enc_params, "ipct");
-    enc.quality = get_optval(enc_params, "qp");
-    enc.rc_mode = get_optval(enc_params, "rc_mode");
-    spec_bps = get_optval(enc_params, "kbps");
-    if (spec_bps == AUTO_BITRATE) {
-        enc.bitrate = estimate_bitrate(enc.quality * 100 / DSV_MAX_QUALITY, enc.gop, &md);
-    } else {
-        enc.bitrate = spec_bps;
+    setup_encoder(&enc, &md);
+    
+    nrungs = get_optval(enc_params, "rungs");
+    for (k = 0; k < nrungs; k++) {
+        DSV_META *pmd = k ? &rung_md[k - 1] : &md;
+        
+        rung_md[k] = *pmd;
+        rung_md[k].width = DSV_ROUND_SHIFT(pmd->width, 1);
+        rung_md[k].height = DSV_ROUND_SHIFT(pmd->height, 1);
+        if (rung_md[k].width < 16 || rung_md[k].height < 16) {
+            DSV_WARNING(("video is too small for %d ladder rungs", nrungs));
+            break;
+        }
+        setup_encoder(&rungs[k], &rung_md[k]);
+        if (get_optval(enc_params, "kbps") != AUTO_BITRATE) {
+            rungs[k].bitrate = enc.bitrate >> (2 * (k + 1)); /* by area */
+        }
+        dsv_enc_set_parent(&rungs[k], k ? &rungs[k - 1] : &enc);
+        memset(&rung_out[k], 0, sizeof(rung_out[k]));
+        rung_paths[k] = NULL;
+    }
+    nrungs = k;
+    /* ask about every file before spending any time encoding, the packets
+     * then go to their files as they are encoded */
+    for (k = 0; k < nrungs; k++) {
+        rung_paths[k] = rung_path(opts.out, k);
+        if (rung_paths[k] == NULL || !promptoverwrite(rung_paths[k])) {
+            goto fail;
+        }
     }
-    if (enc.rc_mode == DSV_RATE_CONTROL_ABR) {
-        enc.quality = CLAMP(enc.quality * 3 / 2, 0, DSV_MAX_QUALITY);
+    if (!stream_open(&output, opts.out)) {
+        goto fail;
     }
-    enc.max_q_step = get_optval(enc_params, "maxqstep");
-    enc.min_quality = get_optval(enc_params, "minqp");
-    enc.max_quality = get_optval(enc_params, "maxqp");
-    enc.min_I_frame_quality = get_optval(enc_params, "iminqp");
-
-    enc.rc_high_motion_nudge = get_optval(enc_params, "rc_hmnudge");
-    enc.pyramid_levels = get_optval(enc_params, "pyrlevels");
-    enc.stable_refresh = get_optval(enc_params, "stabref");
-    if (enc.stable_refresh == 0) {
-        enc.stable_refresh = CLAMP(enc.gop - 1, 1, 14);
+    for (k = 0; k < nrungs; k++) {
+        if (!stream_open(&rung_out[k], rung_paths[k])) {
+            goto fail;
+        }
+        stream_sink(&rungs[k], &rung_out[k]);
     }
 
     frno = get_optval(enc_params, "sfr");
@@ -496,67 +1116,134 @@ encode(void)
         maxframe = -1;
     }
 
-    DSV_INFO(("starting encoder"));
-    dsv_enc_start(&enc);
-    run = 1;
     if (verbose) {
         printf(DRV_HEADER);
         printf("\n");
     }
+    jobs = get_optval(enc_params, "jobs");
+    if (jobs > 1 && nrungs > 0) {
+        DSV_WARNING(("ladder encoding can not be split into GOPs, using one job"));
+        jobs = 1;
+    }
+    if (jobs > 1) {
+        long avail = yuv_num_frames(&reader);
+        
+        if (avail < 0 || enc.gop == DSV_GOP_INF) {
+            DSV_WARNING(("input can not be split into GOPs, using one job"));
+        } else {
+            int chunklen = enc.gop == DSV_GOP_INTRA ? INTRA_CHUNK_LEN : enc.gop;
+            
+            if (maxframe > 0 && maxframe < avail) {
+                avail = maxframe;
+            }
+            avail -= frno;
+            frno = encode_gops(&md, &reader, frno, avail > 0 ? avail : 0, chunklen, jobs, &enc.stats);
+            goto done;
+        }
+    }
+    
+    DSV_INFO(("starting encoder"));
+    stream_sink(&enc, &output);
+    dsv_enc_start(&enc);
+    for (k = 0; k < nrungs; k++) {
+        dsv_enc_start(&rungs[k]);
+    }
+    run = 1;
     while (run) {
         int state;
         if (maxframe > 0 && frno >= (unsigned) maxframe) {
             goto end_of_stream;
         }
-        if (dsv_yuv_read(inpfile, frno, picture, w, h, md.subsamp) < 0) {
+        frame = yuv_read_frame(&reader, frno);
+        if (frame == NULL) {
             DSV_ERROR(("failed to read frame %d", frno));
             goto end_of_stream;
         }
-        frame = dsv_load_planar_frame(md.subsamp, picture, w, h);
         if (verbose) {
             printf("encoding frame %d\r", frno);
             fflush(stdout);
         } else {
             DSV_INFO(("encoding frame %d", frno));
         }
-        state = dsv_enc(&enc, frame, bufs);
+        dsv_memory_frame();
+        state = dsv_enc(&enc, frame, NULL);
         frno++;
      
         run = !(state & DSV_ENC_FINISHED);
-        state &= DSV_ENC_NUM_BUFS;
-        for (i = 0; i < state; i++) {
-            savebuffer(&bufs[i]);
-            dsv_buf_free(&bufs[i]);
+        /* each rung is fed by the one above it */
+        for (k = 0; k < nrungs; k++) {
+            frame = dsv_enc_downscaled(k ? &rungs[k - 1] : &enc);
+            dsv_enc(&rungs[k], frame, NULL);
         }
         continue;
 end_of_stream:
-        dsv_enc_end_of_stream(&enc, bufs);
-        savebuffer(&bufs[0]);
-        dsv_buf_free(&bufs[0]);
+        dsv_enc_end_of_stream(&enc, NULL);
+        for (k = 0; k < nrungs; k++) {
+            dsv_enc_end_of_stream(&rungs[k], NULL);
+        }
         break;
     }
-   
+done:
     if (verbose) {
         /* KBps = kiloBYTES, kbps = kiloBITS */
         int bpf, bps, kbps, mbps;
         
-        bpf = (bufsz * 8) / frno;
+        bpf = (output.total * 8) / frno;
         bps = bpf * fps;
         kbps = bps / 1024;
         mbps = kbps / 1024;
-        printf("\nencoded %d bytes @ %d bps, %d kbps, %d KBps, %d mbps. fps = %d, bpf = %d\n",
-                bufsz, bps, kbps, kbps / 8, mbps, fps, bpf);
+        printf("\nencoded %lu bytes @ %d bps, %d kbps, %d KBps, %d mbps. fps = %d, bpf = %d\n",
+                output.total, bps, kbps, kbps / 8, mbps, fps, bpf);
         printf("target bitrate = %d bps  %d KBps  %d kbps\n",
                 enc.bitrate, enc.bitrate / (8 * 1024), enc.bitrate / 1024);
     }
     
-    writefile(opts.out, enc_buf, bufsz);
-    if (verbose) {
-        printf("saved video file\n");
+    if (!stream_close(&output)) {
+        DSV_ERROR(("failed to write %s", opts.out));
+    } else {
+        if (verbose) {
+            printf("saved video file\n");
+        }
+        if (get_optval(enc_params, "index")) {
+            write_index(opts.out);
+        }
+    }
+    if (enc.deadline) {
+        printf("%lu of %lu frames took longer than %uus, the effort was lowered %lu times\n",
+                enc.stats.deadline_misses, enc.stats.frames, enc.deadline, enc.stats.effort_drops);
+    }
+    write_stats(&enc, NULL);
+    for (k = 0; k < nrungs; k++) {
+        char *path = rung_paths[k];
+        
+        if (!stream_close(&rung_out[k])) {
+            DSV_ERROR(("failed to write %s", path));
+        } else {
+            if (verbose) {
+                printf("saved %dx%d video file %s\n", rung_md[k].width, rung_md[k].height, path);
+            }
+            if (get_optval(enc_params, "index")) {
+                write_index(path);
+            }
+        }
+        free(path);
+        dsv_enc_free(&rungs[k]);
     }
     dsv_enc_free(&enc);
-    fclose(inpfile);
+    yuv_close_reader(&reader);
     return EXIT_SUCCESS;
+fail:
+    for (k = 0; k < nrungs; k++) {
+        stream_close(&rung_out[k]);
+        if (rung_paths[k]) {
+            free(rung_paths[k]);
+        }
+        dsv_enc_free(&rungs[k]);
+    }
+    stream_close(&output);
+    dsv_enc_free(&enc);
+    yuv_close_reader(&reader);
+    return EXIT_FAILURE;
 }
 
 #define DSV_PKT_ERR_EOF -1
@@ -564,6 +1251,22 @@ end_of_stream:
 #define DSV_PKT_ERR_PSZ -3 /* bad packet size */
 #define DSV_PKT_ERR_4CC -4 /* bad 4cc */
 
+/* B.1 Packet Header Link Offsets, size of the packet starting at hdr */
+static int
+packet_len(uint8_t *hdr)
+{
+    int size;
+    
+    size = (hdr[DSV_PACKET_NEXT_OFFSET + 0] << 24) |
+           (hdr[DSV_PACKET_NEXT_OFFSET + 1] << 16) |
+           (hdr[DSV_PACKET_NEXT_OFFSET + 2] << 8) |
+           (hdr[DSV_PACKET_NEXT_OFFSET + 3]);
+    if (size == 0) {
+        size = DSV_PACKET_HDR_SIZE;
+    }
+    return size;
+}
+
 static int
 read_packet(FILE *f, DSV_BUF *rb, int *packet_type)
 {
@@ -587,13 +1290,7 @@ read_packet(FILE *f, DSV_BUF *rb, int *packet_type)
         return DSV_PKT_ERR_4CC;
     }
     /* DSV_INFO(("DSV version 1.%d", hdr[4])); */
-    size = (hdr[DSV_PACKET_NEXT_OFFSET + 0] << 24) |
-           (hdr[DSV_PACKET_NEXT_OFFSET + 1] << 16) |
-           (hdr[DSV_PACKET_NEXT_OFFSET + 2] << 8) |
-           (hdr[DSV_PACKET_NEXT_OFFSET + 3]);
-    if (size == 0) {
-        size = DSV_PACKET_HDR_SIZE;
-    }
+    size = packet_len(hdr);
     if (size < DSV_PACKET_HDR_SIZE) {
         DSV_ERROR(("bad packet size"));
         return DSV_PKT_ERR_PSZ;
@@ -611,6 +1308,198 @@ read_packet(FILE *f, DSV_BUF *rb, int *packet_type)
     return 1;
 }
 
+
+/* write a decoded frame to its place in the output,
+ * lock (if any) is held while the writer is used */
+static void
+output_frame(YUV_WRITER *w, DSV_MUTEX *lock, DSV_FRAME *frame, int subsamp, DSV_FNUM fno, int to_420p)
+{
+    if (to_420p && subsamp != DSV_SUBSAMP_420) {
+        DSV_FRAME *f420 = dsv_mk_frame(DSV_SUBSAMP_420, frame->width, frame->height, 0);
+        if (subsamp == DSV_SUBSAMP_444) {
+            DSV_FRAME *f422 = dsv_mk_frame(DSV_SUBSAMP_422, frame->width, frame->height, 0);
+            conv444to422(&frame->planes[1], &f422->planes[1]);
+            conv444to422(&frame->planes[2], &f422->planes[2]);
+            conv422to420(&f422->planes[1], &f420->planes[1]);
+            conv422to420(&f422->planes[2], &f420->planes[2]);
+            dsv_frame_ref_dec(f422);
+        } else {
+            conv422to420(&frame->planes[1], &f420->planes[1]);
+            conv422to420(&frame->planes[2], &f420->planes[2]);
+        }
+        { /* copy luma 1:1 */
+            DSV_PLANE *cs = frame->planes;
+            DSV_PLANE *cd = f420->planes;
+            unsigned int rowlen = frame->planes[0].w;
+            int i;
+            for (i = 0; i < f420->planes[0].h; i++) {
+                memcpy(DSV_GET_LINE(cd, i), DSV_GET_LINE(cs, i), rowlen);
+            }
+        }
+        frame = f420;
+    } else {
+        dsv_frame_ref_inc(frame);
+    }
+    dsv_mutex_lock(lock);
+    if (yuv_write_frame(w, fno, frame->planes) < 0) {
+        DSV_ERROR(("failed to write frame %d", fno));
+    }
+    dsv_mutex_unlock(lock);
+    dsv_frame_ref_dec(frame);
+}
+
+/* GOP parallel decoding
+ *
+ * every intra picture starts a GOP that only needs the metadata in effect to
+ * be decoded. The seek index tells where the GOPs start, pieces of the
+ * stream are then decoded by separate decoders and each frame is written
+ * to its place in the output.
+ */
+#define DEC_CHUNK_PICS 16 /* fewest pictures per piece, except the last */
+
+struct DEC_CHUNK {
+    DSV_INDEX_ENTRY *first; /* picture the piece starts with */
+    DSV_OFF end; /* offset just past the last packet */
+};
+
+struct DEC_JOBS {
+    struct DEC_CHUNK *chunks;
+    int nchunks;
+    int next;
+    int to_420p;
+    DSV_FNUM sfr, efr; /* frames outside of [sfr, efr) are not written */
+    DSV_MUTEX *lock;
+    YUV_WRITER *writer;
+    DSV_STATS stats; /* of all the decoders together */
+};
+
+/* split the pictures from the GOP of frame sfr up to (not including)
+ * frame efr into pieces */
+static struct DEC_CHUNK *
+split_gops(DSV_INDEX *x, DSV_FNUM sfr, DSV_FNUM efr, int *nchunks)
+{
+    struct DEC_CHUNK *chunks;
+    DSV_INDEX_ENTRY *e;
+    int i, n = 0, pics = 0;
+
+    chunks = calloc(x->n, sizeof(*chunks));
+    if (chunks == NULL) {
+        return NULL;
+    }
+    for (i = dsv_index_find(x, sfr) - x->ents; i < x->n; i++) {
+        e = &x->ents[i];
+        if (e->fno >= efr) {
+            break;
+        }
+        if (n == 0 || (!DSV_PT_HAS_REF(e->type) && pics >= DEC_CHUNK_PICS)) {
+            if (n > 0) {
+                chunks[n - 1].end = e->pos;
+            }
+            chunks[n].first = e;
+            n++;
+            pics = 0;
+        }
+        pics++;
+    }
+    if (n > 0) {
+        chunks[n - 1].end = (i < x->n) ? x->ents[i].pos : x->end;
+    }
+    *nchunks = n;
+    return chunks;
+}
+
+static void
+decode_chunk(struct DEC_JOBS *dj, FILE *f, struct DEC_CHUNK *c)
+{
+    DSV_DECODER dec;
+    DSV_BUF buffer;
+    DSV_FRAME *frame;
+    DSV_FNUM fno;
+    int type;
+
+    memset(&dec, 0, sizeof(dec));
+    dec.draw_info = get_optval(dec_params, "drawinfo");
+    dec.hpel_planes = get_optval(dec_params, "cachehp");
+    dec.threads = get_optval(dec_params, "threads");
+    dec.scale = get_optval(dec_params, "scale");
+    dec.stats.enabled = (opts.stats != NULL);
+    if (!dsv_dec_seek(&dec, f, c->first)) {
+        dsv_dec_free(&dec);
+        return;
+    }
+    while (dsv_ftell(f) < c->end) {
+        if (read_packet(f, &buffer, &type) < 0) {
+            DSV_ERROR(("error reading packet"));
+            break;
+        }
+        if (dsv_dec(&dec, &buffer, &frame, &fno) == DSV_DEC_OK && frame) {
+            if (fno >= dj->sfr && fno < dj->efr) {
+                output_frame(dj->writer, dj->lock, frame, dec.vidmeta.subsamp, fno - dj->sfr, dj->to_420p);
+            }
+            dsv_frame_ref_dec(frame);
+        }
+    }
+    dsv_mutex_lock(dj->lock);
+    dsv_stats_add(&dj->stats, &dec.stats);
+    dsv_mutex_unlock(dj->lock);
+    dsv_dec_free(&dec);
+}
+
+static void
+dec_gop_worker(void *arg, int idx)
+{
+    struct DEC_JOBS *dj = arg;
+    FILE *f;
+    int i;
+
+    /* every worker reads the packets it needs on its own */
+    f = fopen(opts.inp, "rb");
+    if (f == NULL) {
+        DSV_ERROR(("worker %d could not open input %s", idx, opts.inp));
+        return;
+    }
+    while (1) {
+        dsv_mutex_lock(dj->lock);
+        i = dj->next++;
+        if (i < dj->nchunks && verbose) {
+            printf("decoding GOP %d/%d\r", i + 1, dj->nchunks);
+            fflush(stdout);
+        }
+        dsv_mutex_unlock(dj->lock);
+        if (i >= dj->nchunks) {
+            break;
+        }
+        decode_chunk(dj, f, &dj->chunks[i]);
+    }
+    fclose(f);
+}
+
+static void
+decode_gops(DSV_INDEX *x, YUV_WRITER *w, int jobs, int to_420p, DSV_FNUM sfr, DSV_FNUM efr, DSV_STATS *stats)
+{
+    struct DEC_JOBS dj;
+
+    memset(&dj, 0, sizeof(dj));
+    dj.chunks = split_gops(x, sfr, efr, &dj.nchunks);
+    if (dj.chunks == NULL) {
+        DSV_ERROR(("out of memory"));
+        return;
+    }
+    dj.to_420p = to_420p;
+    dj.sfr = sfr;
+    dj.efr = efr;
+    dj.writer = w;
+    dj.lock = dsv_mutex_new();
+    dj.stats.enabled = stats->enabled;
+    DSV_INFO(("decoding %d GOPs with %d jobs", dj.nchunks, jobs));
+    if (dj.nchunks > 0) {
+        dsv_parallel(MIN(jobs, dj.nchunks), dec_gop_worker, &dj);
+    }
+    dsv_mutex_free(dj.lock);
+    dsv_stats_add(stats, &dj.stats);
+    free(dj.chunks);
+}
+
 static int
 decode(void)
 {
@@ -618,10 +1507,17 @@ decode(void)
     DSV_BUF buffer;
     DSV_META *meta = NULL;
     DSV_FRAME *frame;
+    DSV_INDEX index;
+    DSV_INDEX_ENTRY *ent;
+    char offs[DSV_OFF_STRLEN];
     int code;
     DSV_FNUM frameno = 0;
+    DSV_FNUM sfr, efr;
     int to_420p;
-    FILE *inpfile, *outfile;
+    int eos = 0, done = 0;
+    int jobs, mkindex, nfr;
+    FILE *inpfile;
+    YUV_WRITER writer;
     
     inpfile = fopen(opts.inp, "rb");
     if (inpfile == NULL) {
@@ -629,34 +1525,74 @@ decode(void)
         return EXIT_FAILURE;
     }
 
-    outfile = fopen(opts.out, "wb");
-    if (outfile == NULL) {
+    if (!yuv_open_writer(&writer, opts.out)) {
         printf("error opening output file %s\n", opts.out);
         return EXIT_FAILURE;
     }
     memset(&dec, 0, sizeof(dec));
+    memset(&index, 0, sizeof(index));
     to_420p = get_optval(dec_params, "out420p");
     dec.draw_info = get_optval(dec_params, "drawinfo");
+    dec.hpel_planes = get_optval(dec_params, "cachehp");
+    dec.threads = get_optval(dec_params, "threads");
+    dec.scale = get_optval(dec_params, "scale");
+    dec.stats.enabled = (opts.stats != NULL);
+    jobs = get_optval(dec_params, "jobs");
+    mkindex = get_optval(dec_params, "index");
+    sfr = get_optval(dec_params, "sfr");
+    nfr = get_optval(dec_params, "nfr");
+    efr = (nfr < 0) ? (DSV_FNUM) -1 : sfr + nfr;
     if (verbose) {
         printf(DRV_HEADER);
         printf("\n");
     }
-    while (1) {
+    if (jobs > 1 && !writer.seekable) {
+        DSV_WARNING(("-jobs needs an output file, decoding with one job"));
+        jobs = 1;
+    }
+    if (jobs > 1 || sfr > 0 || mkindex) {
+        if (!get_index(&index, inpfile, opts.inp, mkindex)) {
+            DSV_WARNING(("could not index the input, decoding it from the start with one job"));
+            jobs = 1;
+            sfr = 0;
+        }
+        rewind(inpfile);
+    }
+    if (jobs > 1) {
+        decode_gops(&index, &writer, jobs, to_420p, sfr, efr, &dec.stats);
+        done = 1;
+    } else if (sfr > 0) {
+        ent = dsv_index_find(&index, sfr);
+        DSV_INFO(("seeking to frame %u at %s", ent->fno, dsv_off_str(ent->pos, offs)));
+        if (dsv_dec_seek(&dec, inpfile, ent)) {
+            meta = dsv_get_metadata(&dec);
+        } else {
+            done = 1;
+        }
+    }
+    /* only now, the metadata packet of a seek is decoded synchronously */
+    dec.pipeline = get_optval(dec_params, "pipeline");
+    while (!done) {
         int packet_type;
+        DSV_BUF *bp = NULL; /* NULL once there are no more packets */
 
-        if (read_packet(inpfile, &buffer, &packet_type) < 0) {
-            DSV_ERROR(("error reading packet"));
-            break;
+        if (!eos) {
+            if (read_packet(inpfile, &buffer, &packet_type) < 0) {
+                DSV_ERROR(("error reading packet"));
+                eos = 1;
+            } else {
+                bp = &buffer;
+                eos = (packet_type == DSV_PT_EOS);
+            }
         }
 
-        code = dsv_dec(&dec, &buffer, &frame, &frameno);
+        dsv_memory_frame();
+        code = dsv_dec(&dec, bp, &frame, &frameno);
         
         if (code == DSV_DEC_GOT_META) {
-            static int got_it_once = 0;
             /* TODO: check if parameters changed mid-video? */
-            if (!got_it_once) {
+            if (meta == NULL) {
                 meta = dsv_get_metadata(&dec);
-                got_it_once = 1;
                 DSV_INFO(("got metadata"));
             }
         } else {
@@ -671,40 +1607,16 @@ decode(void)
                 DSV_ERROR(("no metadata!"));
                 break;
             }
-            if (to_420p && meta->subsamp != DSV_SUBSAMP_420) {
-                DSV_FRAME *f420 = dsv_mk_frame(DSV_SUBSAMP_420, frame->width, frame->height, 0);
-                if (meta->subsamp == DSV_SUBSAMP_444) {
-                    DSV_FRAME *f422 = dsv_mk_frame(DSV_SUBSAMP_422, frame->width, frame->height, 0);
-                    conv444to422(&frame->planes[1], &f422->planes[1]);
-                    conv444to422(&frame->planes[2], &f422->planes[2]);
-                    conv422to420(&f422->planes[1], &f420->planes[1]);
-                    conv422to420(&f422->planes[2], &f420->planes[2]);
-                    dsv_frame_ref_dec(f422);
-                } else {
-                    conv422to420(&frame->planes[1], &f420->planes[1]);
-                    conv422to420(&frame->planes[2], &f420->planes[2]);
-                }
-                { /* copy luma 1:1 */
-                    DSV_PLANE *cs = frame->planes;
-                    DSV_PLANE *cd = f420->planes;
-                    unsigned int rowlen = frame->planes[0].w;
-                    int i;
-                    for (i = 0; i < f420->planes[0].h; i++) {
-                        memcpy(DSV_GET_LINE(cd, i), DSV_GET_LINE(cs, i), rowlen);
-                    }
-                }
-                if (dsv_yuv_write(outfile, frameno, f420->planes) < 0) {
-                    DSV_ERROR(("failed to write frame %d", frameno));
-                }
-                dsv_frame_ref_dec(f420);
-            } else {
-                if (dsv_yuv_write(outfile, frameno, frame->planes) < 0) {
-                    DSV_ERROR(("failed to write frame %d", frameno));
-                }
+            if (frameno >= efr) {
+                dsv_frame_ref_dec(frame);
+                break;
             }
-            if (verbose) {
-                printf("\rdecoded frame %d", frameno);
-                fflush(stdout);
+            if (frameno >= sfr) {
+                output_frame(&writer, NULL, frame, meta->subsamp, frameno - sfr, to_420p);
+                if (verbose) {
+                    printf("\rdecoded frame %d", frameno);
+                    fflush(stdout);
+                }
             }
             dsv_frame_ref_dec(frame);
         }
@@ -712,30 +1624,320 @@ decode(void)
     if (verbose) {
         printf("\n");
     }
+    write_stats(NULL, &dec.stats);
     DSV_INFO(("freeing decoder"));
     dsv_dec_free(&dec);
-    dsv_free(meta);
+    dsv_index_free(&index);
+    if (meta) {
+        dsv_free(meta);
+    }
     fclose(inpfile);
-    fclose(outfile);
+    if (yuv_close_writer(&writer) < 0) {
+        DSV_ERROR(("failed to write output"));
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
 }
 
+/* Benchmark
+ *
+ * encodes the input into memory, decodes it again and reports how long each
+ * stage of the codec took as JSON. Optionally compares the throughput
+ * against a JSON file written by an earlier run.
+ */
+
+#define BENCH_MIN_USEC 1000
+
+struct BENCH {
+    FILE *f;
+    char *base; /* contents of the baseline file, or NULL */
+    int tol; /* percent slower than the baseline that counts as a regression */
+    int regressions;
+    unsigned frames;
+    unsigned long pixels; /* luma pixels per frame */
+};
+
+static char *
+loadfile(char *n)
+{
+    FILE *fp;
+    char *buf;
+    long len;
+    
+    fp = fopen(n, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    if (fseek(fp, 0, SEEK_END) || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET)) {
+        fclose(fp);
+        return NULL;
+    }
+    buf = malloc(len + 1);
+    if (buf && fread(buf, 1, len, fp) != (size_t) len) {
+        free(buf);
+        buf = NULL;
+    }
+    if (buf) {
+        buf[len] = '\0';
+    }
+    fclose(fp);
+    return buf;
+}
+
+/* only understands the files bench writes, fps in hundredths,
+ * returns -1 if not found */
+static long
+base_fps(char *json, char *section, char *name)
+{
+    char key[64];
+    char *p, *tail;
+    long v;
+    
+    sprintf(key, "\"%s\": {", section);
+    p = strstr(json, key);
+    if (p == NULL) {
+        return -1;
+    }
+    sprintf(key, "\"%s\": {", name);
+    p = strstr(p, key);
+    if (p == NULL) {
+        return -1;
+    }
+    p = strstr(p, "\"fps\": ");
+    if (p == NULL) {
+        return -1;
+    }
+    v = strtol(p + 7, &tail, 10);
+    if (tail == p + 7 || v < 0) {
+        return -1;
+    }
+    v *= 100;
+    /* "%lu.%02lu" as written by bench_entry */
+    if (*tail == '.' && tail[1] >= '0' && tail[1] <= '9') {
+        v += (tail[1] - '0') * 10;
+        if (tail[2] >= '0' && tail[2] <= '9') {
+            v += tail[2] - '0';
+        }
+    }
+    return v;
+}
+
+static void
+bench_entry(struct BENCH *b, char *section, char *name, unsigned long usec, long calls, int last)
+{
+    /* fps and megapixels per second in hundredths,
+     * change in tenths of a percent */
+    long fps = 0, mpps = 0, base, change, mag;
+    
+    if (usec > 0) {
+        fps = (long) ((uint64_t) b->frames * 100000000 / usec);
+        mpps = (long) ((uint64_t) b->frames * b->pixels * 100 / usec);
+    }
+    fprintf(b->f, "\"%s\": { \"usec\": %lu, ", name, usec);
+    if (calls >= 0) {
+        fprintf(b->f, "\"calls\": %ld, ", calls);
+    }
+    fprintf(b->f, "\"fps\": %ld.%02ld, \"mpixels_per_sec\": %ld.%02ld",
+            fps / 100, fps % 100, mpps / 100, mpps % 100);
+    if (b->base) {
+        base = base_fps(b->base, section, name);
+        if (base > 0 && fps > 0) {
+            change = (long) (((int64_t) fps - base) * 1000 / base);
+            mag = change < 0 ? -change : change;
+            fprintf(b->f, ", \"base_fps\": %ld.%02ld, \"change_pct\": %s%ld.%ld",
+                    base / 100, base % 100, change < 0 ? "-" : "", mag / 10, mag % 10);
+            /* too short to be measured reliably otherwise */
+            if (change < -b->tol * 10L && usec >= BENCH_MIN_USEC) {
+                b->regressions++;
+                DSV_WARNING(("%s %s is %ld.%ld%% slower than the baseline", section, name, mag / 10, mag % 10));
+            }
+        }
+    }
+    fprintf(b->f, " }%s\n", last ? "" : ",");
+}
+
+static void
+bench_section(struct BENCH *b, char *section, unsigned long usec, DSV_STATS *t)
+{
+    int i;
+    
+    fprintf(b->f, "  \"%s\": {\n    ", section);
+    bench_entry(b, section, "total", usec, -1, 0);
+    fprintf(b->f, "    \"stages\": {\n");
+    for (i = 0; i < DSV_NUM_STAGES; i++) {
+        fprintf(b->f, "      ");
+        bench_entry(b, section, stage_names[i], t->usec[i], t->calls[i], i == DSV_NUM_STAGES - 1);
+    }
+    fprintf(b->f, "    }\n  },\n");
+}
+
+static int
+bench(void)
+{
+    struct BENCH b;
+    DSV_META md;
+    DSV_ENCODER enc;
+    DSV_DECODER dec;
+    DSV_FRAME *frame;
+    DSV_BUF buf;
+    DSV_FNUM fno;
+    YUV_READER reader;
+    unsigned long t, enc_usec, dec_usec;
+    unsigned frno, pos;
+    int nfr, size, code, i;
+    
+    memset(&b, 0, sizeof(b));
+    b.tol = bench_opts.tol;
+    if (bench_opts.base) {
+        b.base = loadfile(bench_opts.base);
+        if (b.base == NULL) {
+            printf("error reading baseline file %s\n", bench_opts.base);
+            return EXIT_FAILURE;
+        }
+    }
+    setup_meta(&md);
+    if (!open_input(&reader, &md)) {
+        printf("error opening input %s\n", input_name());
+        return EXIT_FAILURE;
+    }
+    setup_encoder(&enc, &md);
+    stream_sink(&enc, &output);
+    enc.stats.enabled = 1;
+    
+    frno = get_optval(enc_params, "sfr");
+    nfr = get_optval(enc_params, "nfr");
+    if (verbose) {
+        printf(DRV_HEADER);
+        printf("\n");
+    }
+    
+    dsv_enc_start(&enc);
+    enc_usec = dsv_usec();
+    for (; nfr < 0 || b.frames < (unsigned) nfr; frno++) {
+        t = dsv_timer_start(&enc.stats);
+        frame = yuv_read_frame(&reader, frno);
+        dsv_timer_stop(&enc.stats, DSV_STAGE_IO, t);
+        if (frame == NULL) {
+            break;
+        }
+        if (verbose) {
+            printf("encoding frame %d\r", frno);
+            fflush(stdout);
+        }
+        b.frames++;
+        dsv_memory_frame();
+        if (dsv_enc(&enc, frame, NULL) & DSV_ENC_FINISHED) {
+            break;
+        }
+    }
+    dsv_enc_end_of_stream(&enc, NULL);
+    enc_usec = dsv_usec() - enc_usec;
+    yuv_close_reader(&reader);
+    if (b.frames == 0) {
+        printf("no frames could be read from %s\n", input_name());
+        dsv_enc_free(&enc);
+        return EXIT_FAILURE;
+    }
+    
+    memset(&dec, 0, sizeof(dec));
+    dec.stats.enabled = 1;
+    dec_usec = dsv_usec();
+    for (pos = 0; pos + DSV_PACKET_HDR_SIZE <= output.len; pos += size) {
+        size = packet_len(output.data + pos);
+        if (size < DSV_PACKET_HDR_SIZE || pos + size > output.len) {
+            DSV_ERROR(("bad packet size"));
+            break;
+        }
+        t = dsv_timer_start(&dec.stats);
+        dsv_mk_buf(&buf, size);
+        memcpy(buf.data, output.data + pos, size);
+        dsv_timer_stop(&dec.stats, DSV_STAGE_IO, t);
+        
+        dsv_memory_frame();
+        code = dsv_dec(&dec, &buf, &frame, &fno);
+        if (code == DSV_DEC_EOS) {
+            break;
+        }
+        if (code == DSV_DEC_OK && frame) {
+            if (verbose) {
+                printf("decoding frame %d\r", fno);
+                fflush(stdout);
+            }
+            dsv_frame_ref_dec(frame);
+        }
+    }
+    dec_usec = dsv_usec() - dec_usec;
+    
+    if (strcmp(opts.out, "-") == 0) {
+        b.f = stdout;
+    } else {
+        b.f = fopen(opts.out, "w");
+        if (b.f == NULL) {
+            perror("unable to open file");
+            b.regressions = -1;
+            goto done;
+        }
+    }
+    b.pixels = (unsigned long) md.width * md.height;
+    fprintf(b.f, "{\n  \"codec\": \"DSV 1.%d\",\n  \"input\": ", DSV_VERSION_MINOR);
+    json_string(b.f, input_name());
+    fprintf(b.f, ",\n  \"width\": %d,\n  \"height\": %d,\n  \"subsamp\": %d,\n",
+            md.width, md.height, md.subsamp);
+    fprintf(b.f, "  \"frames\": %u,\n  \"bytes\": %u,\n", b.frames, output.len);
+    if (b.base) {
+        fprintf(b.f, "  \"tolerance_pct\": %d,\n", b.tol);
+    }
+    bench_section(&b, "encode", enc_usec, &enc.stats);
+    bench_section(&b, "decode", dec_usec, &dec.stats);
+    fprintf(b.f, "  \"regressions\": %d\n}\n", b.regressions);
+    if (b.f != stdout) {
+        fclose(b.f);
+    }
+    write_stats(&enc, &dec.stats);
+    if (verbose) {
+        printf("\n%-10s %12s %12s\n", "stage", "encode ms", "decode ms");
+        for (i = 0; i < DSV_NUM_STAGES; i++) {
+            printf("%-10s %12lu %12lu\n", stage_names[i],
+                    enc.stats.usec[i] / 1000, dec.stats.usec[i] / 1000);
+        }
+        printf("%-10s %12lu %12lu\n", "total", enc_usec / 1000, dec_usec / 1000);
+        printf("%u frames, %u bytes\n", b.frames, output.len);
+    }
+done:
+    dsv_dec_free(&dec);
+    dsv_enc_free(&enc);
+    if (b.base) {
+        free(b.base);
+    }
+    return b.regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 static int
 startup(int argc, char **argv)
 {
+    int synth;
+    
     if (!init_params(argc, argv)) {
         return EXIT_SUCCESS;
     }
-    if (!opts.inp || !opts.out) {
+    synth = encoding && get_optval(enc_params, "synth") != SYNTH_NONE;
+    if ((!opts.inp && !synth) || !opts.out) {
         printf("inp or out was not specified!\n");
         usage();
         return EXIT_FAILURE;
     }
     
-    if (!promptoverwrite(opts.out)) {
+    if ((!encoding || benching) && strcmp(opts.out, "-") == 0) {
+        /* all console output goes to stdout, keep it out of the video */
+        verbose = 0;
+        dsv_set_log_level(DSV_LEVEL_NONE);
+    } else if (!promptoverwrite(opts.out)) {
         return EXIT_FAILURE;
     }
     
+    if (benching) {
+        return bench();
+    }
     if (encoding) {
         return encode();
     }
@@ -751,6 +1953,11 @@ split_paths(int argc, char **argv)
     if (argc < 2) {
         goto badarg;
     }
+    if (strcmp(argv[1], "bench") == 0) {
+        encoding = 1;
+        benching = 1;
+        return startup(argc - 1, argv + 1);
+    }
     if (argv[1][0] == 'e') {
         encoding = 1;
         return startup(argc - 1, argv + 1);
@@ -55,7 +55,7 @@ dsv_mk_coefs(DSV_COEFS *c, int format, int width, int height)
     
     c2len = c[2].width * c[2].height;
 
-    c[0].data = dsv_alloc((c0len + c1len + c2len) * sizeof(DSV_SBC));
+    c[0].data = dsv_alloc_tag((c0len + c1len + c2len) * sizeof(DSV_SBC), DSV_MEM_COEFS);
     c[1].data = c[0].data + c0len;
     c[2].data = c[0].data + c0len + c1len;
 }
@@ -110,7 +110,7 @@ dsv_mk_frame(int format, int width, int height, int border)
     f->planes[2].hs = h_shift;
     f->planes[2].vs = v_shift;
     
-    f->alloc = dsv_alloc(f->planes[0].len + f->planes[1].len + f->planes[2].len);
+    f->alloc = dsv_alloc_tag(f->planes[0].len + f->planes[1].len + f->planes[2].len, DSV_MEM_FRAME);
     
     f->planes[0].data = f->alloc + f->planes[0].stride * ext + ext;
     f->planes[1].data = f->alloc + f->planes[0].len + f->planes[1].stride * ext + ext;
@@ -237,12 +237,10 @@ dsv_frame_avg_luma(DSV_FRAME *frame)
     return acc / (plane->w * plane->h);
 }
 
-extern void
-dsv_ds2x_frame_luma(DSV_FRAME *dst, DSV_FRAME *src)
+static void
+ds2x_plane(DSV_PLANE *d, DSV_PLANE *s)
 {
     int i, j;
-    DSV_PLANE *s = src->planes + 0;
-    DSV_PLANE *d = dst->planes + 0;
 
     for (j = 0; j < d->h; j++) {
         uint8_t *sp = DSV_GET_LINE(s, (j << 1));
@@ -260,6 +258,19 @@ dsv_ds2x_frame_luma(DSV_FRAME *dst, DSV_FRAME *src)
     }
 }
 
+extern void
+dsv_ds2x_frame_luma(DSV_FRAME *dst, DSV_FRAME *src)
+{
+    ds2x_plane(dst->planes + 0, src->planes + 0);
+}
+
+extern void
+dsv_ds2x_frame_chroma(DSV_FRAME *dst, DSV_FRAME *src)
+{
+    ds2x_plane(dst->planes + 1, src->planes + 1);
+    ds2x_plane(dst->planes + 2, src->planes + 2);
+}
+
 extern DSV_FRAME *
 dsv_extend_frame(DSV_FRAME *frame)
 {
@@ -28,6 +28,7 @@ clamp_u8(int v)
 #define HP_SAD_SZ 14
 #define HP_DIM    (HP_SAD_SZ + 2)
 #define HP_STRIDE (HP_DIM * 2)
+#define STATIC_DIF 2 /* the most a pixel of a static block may change by */
 
 #define MAKE_SAD(w) \
 static int                                                                    \
@@ -144,24 +145,49 @@ invalid_block(DSV_FRAME *f, int x, int y, int sx, int sy)
  * simulate reduced range intra BMC to see if this block would
  * not be able to be represented properly as intra
  */
-static unsigned
-block_intra_test(DSV_PLANE *p, DSV_PLANE *rp, int w, int h)
+static int
+block_avg(DSV_PLANE *p, int w, int h)
 {
-    int i, j, dif, thresh;
-    int ravg = 0;
-    int nb = 0;
-    uint8_t *ref = rp->data;
-    uint8_t *dec = p->data;
+    int i, j;
+    int avg = 0;
+    uint8_t *ptr = p->data;
+    
+    for (j = 0; j < h; j++) {
+        for (i = 0; i < w; i++) {
+            avg += ptr[i];
+        }
+        ptr += p->stride;
+    }
+    return avg / (w * h);
+}
+
+/* nonzero if no pixel of the block differs by more than maxdif */
+static int
+unchanged(uint8_t *a, int as, uint8_t *b, int bs, int w, int h, int maxdif)
+{
+    int i, j;
     
-    thresh = 0;
     for (j = 0; j < h; j++) {
         for (i = 0; i < w; i++) {
-            ravg += ref[i];
+            if (abs(a[i] - b[i]) > maxdif) {
+                return 0;
+            }
         }
-        ref += rp->stride;
+        a += as;
+        b += bs;
     }
-    ravg /= (w * h);
+    return 1;
+}
 
+/* ravg = block_avg of the reference block */
+static unsigned
+block_intra_test(DSV_PLANE *p, int ravg, int w, int h)
+{
+    int i, j, dif, thresh;
+    int nb = 0;
+    uint8_t *dec = p->data;
+    
+    thresh = 0;
     for (j = 0; j < h; j++) {
         for (i = 0; i < w; i++) {
             dif = clamp_u8((ravg + clamp_u8((dec[i] - ravg) + 128)) - 128);
@@ -209,9 +235,9 @@ block_texture(uint8_t *ptr, int stride, int *avg, int *var)
     return (sh / (HP_SAD_SZ * HP_SAD_SZ));
 }
 
-/* variance and texture */
+/* variance, texture, and average */
 static unsigned
-block_analysis(DSV_PLANE *p, int w, int h, unsigned *texture)
+block_analysis(DSV_PLANE *p, int w, int h, unsigned *texture, int *avg)
 {
     int i, j;
     int prev;
@@ -241,9 +267,70 @@ block_analysis(DSV_PLANE *p, int w, int h, unsigned *texture)
     }
     sh = (sh + sv) / 2;
     *texture = (sh / (w * h));
+    *avg = s / (w * h);
     return (ss - (s * s) / (w * h));
 }
 
+#define MAKE_ANALYSIS(n)                                                      \
+static unsigned                                                               \
+analysis_ ##n(DSV_PLANE *p, int h, unsigned *texture, int *avg)               \
+{                                                                             \
+    int i, j;                                                                 \
+    int prev;                                                                 \
+    int px;                                                                   \
+    unsigned s = 0, ss = 0;                                                   \
+    unsigned sh = 0;                                                          \
+    unsigned sv = 0;                                                          \
+    uint8_t *ptr;                                                             \
+    uint8_t *prevptr;                                                         \
+    ptr = p->data;                                                            \
+    j = h;                                                                    \
+    prevptr = ptr;                                                            \
+    while (j-- > 0) {                                                         \
+        i = n;                                                                \
+        prev = ptr[i - 1];                                                    \
+        while (i-- > 0) {                                                     \
+            px = ptr[i];                                                      \
+            sh += abs(px - prev);                                             \
+            sv += abs(px - prevptr[i]);                                       \
+            s += px;                                                          \
+            ss += px * px;                                                    \
+            prev = px;                                                        \
+        }                                                                     \
+        prevptr = ptr;                                                        \
+        ptr += p->stride;                                                     \
+    }                                                                         \
+    sh = (sh + sv) / 2;                                                       \
+    *texture = (sh / (n * h));                                                \
+    *avg = s / (n * h);                                                       \
+    return (ss - (s * s) / (n * h));                                          \
+}
+
+MAKE_ANALYSIS(16)
+MAKE_ANALYSIS(24)
+MAKE_ANALYSIS(32)
+MAKE_ANALYSIS(48)
+MAKE_ANALYSIS(64)
+
+static unsigned
+fast_analysis(DSV_PLANE *p, int w, int h, unsigned *texture, int *avg)
+{
+    switch (w) {
+        case 16:
+            return analysis_16(p, h, texture, avg);
+        case 24:
+            return analysis_24(p, h, texture, avg);
+        case 32:
+            return analysis_32(p, h, texture, avg);
+        case 48:
+            return analysis_48(p, h, texture, avg);
+        case 64:
+            return analysis_64(p, h, texture, avg);
+        default:
+            return block_analysis(p, w, h, texture, avg);
+    }
+}
+
 static unsigned
 y_sqrvar(DSV_PLANE *p, int w, int h)
 {
@@ -299,6 +386,37 @@ c_maxvar(DSV_PLANE *p, int x, int y, int w, int h)
     return MAX(vu, vv);
 }
 
+/* y_sqrvar, block_avg and c_maxvar of a block, measured only once per frame */
+static unsigned
+stat_var(DSV_BLKSTAT *st, DSV_PLANE *p, int w, int h)
+{
+    if (!(st->known & DSV_BLKSTAT_VAR)) {
+        st->var = y_sqrvar(p, w, h);
+        st->known |= DSV_BLKSTAT_VAR;
+    }
+    return st->var;
+}
+
+static int
+stat_avg(DSV_BLKSTAT *st, DSV_PLANE *p, int w, int h)
+{
+    if (!(st->known & DSV_BLKSTAT_AVG)) {
+        st->avg = block_avg(p, w, h);
+        st->known |= DSV_BLKSTAT_AVG;
+    }
+    return st->avg;
+}
+
+static unsigned
+stat_cvar(DSV_BLKSTAT *st, DSV_PLANE *p, int x, int y, int w, int h)
+{
+    if (!(st->known & DSV_BLKSTAT_CVAR)) {
+        st->cvar = c_maxvar(p, x, y, w, h);
+        st->known |= DSV_BLKSTAT_CVAR;
+    }
+    return st->cvar;
+}
+
 static int
 hpsad(uint8_t *a, int as, uint8_t *b)
 {
@@ -350,7 +468,7 @@ hpfv(uint8_t *p, int s)
 static void
 hpel(uint8_t *dec, uint8_t *ref, int rw)
 {
-    static int16_t buf[DSV_MAX_BLOCK_SIZE * DSV_MAX_BLOCK_SIZE];
+    int16_t buf[DSV_MAX_BLOCK_SIZE * DSV_MAX_BLOCK_SIZE];
     uint8_t *decrow;
     int i, j, c, x;
 
@@ -375,6 +493,89 @@ hpel(uint8_t *dec, uint8_t *ref, int rw)
     }
 }
 
+/* half-pel candidate (hx, hy) around full-pel (x, y) out of precomputed
+ * half-pel planes, same values hpel() would have produced */
+static uint8_t *
+hp_block(DSV_FRAME **hp, DSV_FRAME *ref, int x, int y, int hx, int hy, int *stride)
+{
+    DSV_PLANE *p;
+    int phase;
+    
+    phase = ((hx & 1) << 1) | (hy & 1);
+    p = phase ? hp[phase - 1]->planes : ref->planes;
+    *stride = p->stride;
+    return DSV_GET_XY(p, x + (hx >> 1), y + (hy >> 1));
+}
+
+/* whether all candidates around (x, y) were precomputed, see bmc.c */
+static int
+hp_fits(DSV_FRAME *ref, int x, int y)
+{
+    int w = ref->planes[0].w + DSV_HP_BORDER;
+    int h = ref->planes[0].h + DSV_HP_BORDER;
+    
+    return (x - 1) >= -DSV_HP_BORDER && (x + HP_SAD_SZ) <= w &&
+           (y - 1) >= -DSV_HP_BORDER && (y + HP_SAD_SZ) <= h;
+}
+
+/* each quadrant has to be at least one pixel in every plane */
+static int
+subblocks_fit(DSV_PARAMS *params, int bw, int bh)
+{
+    int subsamp = params->vidmeta->subsamp;
+    
+    return (bw >> DSV_FORMAT_H_SHIFT(subsamp)) >= 2 &&
+           (bh >> DSV_FORMAT_V_SHIFT(subsamp)) >= 2;
+}
+
+/* mark the blocks that are (nearly) unchanged at zero motion in the
+ * coarsest level, they still have to be verified at full resolution */
+static void
+find_statics(DSV_HME *hme)
+{
+    DSV_PARAMS *params = hme->params;
+    DSV_FRAME *src, *ref;
+    DSV_PLANE srcp, refp;
+    int i, j, bx, by, bw, bh;
+    int level = hme->levels;
+    
+    src = hme->src[level];
+    ref = hme->ref[level];
+    for (j = 0; j < params->nblocks_v; j++) {
+        for (i = 0; i < params->nblocks_h; i++) {
+            bx = (i * params->blk_w) >> level;
+            by = (j * params->blk_h) >> level;
+            if ((bx >= src->width) || (by >= src->height)) {
+                continue;
+            }
+            dsv_plane_xy(src, &srcp, 0, bx, by);
+            dsv_plane_xy(ref, &refp, 0, bx, by);
+            bw = MIN(srcp.w, MAX(params->blk_w >> level, 1));
+            bh = MIN(srcp.h, MAX(params->blk_h >> level, 1));
+            hme->statics[i + j * params->nblocks_h] = unchanged(srcp.data,
+                    srcp.stride, refp.data, refp.stride, bw, bh, STATIC_DIF);
+        }
+    }
+}
+
+/* every block covered by the step x step area at (i, j) is static */
+static int
+all_static(DSV_HME *hme, int i, int j, int step)
+{
+    int x, y, nxb, nyb;
+    
+    nxb = hme->params->nblocks_h;
+    nyb = hme->params->nblocks_v;
+    for (y = j; y < MIN(j + step, nyb); y++) {
+        for (x = i; x < MIN(i + step, nxb); x++) {
+            if (!hme->statics[x + y * nxb]) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
 static int
 refine_level(DSV_HME *hme, int level)
 {
@@ -382,18 +583,21 @@ refine_level(DSV_HME *hme, int level)
     DSV_MV *mv;
     DSV_MV *mf, *parent = NULL;
     DSV_PARAMS *params = hme->params;
+    DSV_EFFORT *ef = hme->effort;
     DSV_MV zero;
     int i, j, y_w, y_h, nxb, nyb, step;
     unsigned parent_mask;
     int nintra = 0; /* number of intra blocks */
     DSV_PLANE *sp, *rp;
-    int hpel_thresh, nhp, nsk;
+    int hpel_thresh, nhp, nsk, nhit;
+    int nstatic = 0;
     
     y_w = params->blk_w;
     y_h = params->blk_h;
-    hpel_thresh = (y_w * y_h);
+    hpel_thresh = (y_w * y_h) * ef->hpel_thresh;
     nhp = 0;
     nsk = 0;
+    nhit = 0;
     
     nxb = params->nblocks_h;
     nyb = params->nblocks_v;
@@ -404,7 +608,7 @@ refine_level(DSV_HME *hme, int level)
     sp = src->planes + 0;
     rp = ref->planes + 0;
     
-    hme->mvf[level] = dsv_alloc(sizeof(DSV_MV) * nxb * nyb);
+    hme->mvf[level] = dsv_alloc_tag(sizeof(DSV_MV) * nxb * nyb, DSV_MEM_MOTION);
 
     mf = hme->mvf[level];
     
@@ -419,19 +623,20 @@ refine_level(DSV_HME *hme, int level)
     
     for (j = 0; j < nyb; j += step) {
         for (i = 0; i < nxb; i += step) {
-#define FPEL_NSEARCH 9 /* search points for full-pel search */
-            static int xf[FPEL_NSEARCH] = { 0,  1, -1, 0,  0, -1,  1, -1, 1 };
-            static int yf[FPEL_NSEARCH] = { 0,  0,  0, 1, -1, -1, -1,  1, 1 };
-#define HPEL_NSEARCH 8 /* search points for half-pel search */
-            static int xh[HPEL_NSEARCH] = { 1, -1, 0,  0, -1,  1, -1, 1 };
-            static int yh[HPEL_NSEARCH] = { 0,  0, 1, -1, -1, -1,  1, 1 };
+            /* the center and the cross come first so the search can be
+             * cut short by the effort settings */
+            static int xf[DSV_FPEL_NSEARCH] = { 0,  1, -1, 0,  0, -1,  1, -1, 1 };
+            static int yf[DSV_FPEL_NSEARCH] = { 0,  0,  0, 1, -1, -1, -1,  1, 1 };
+            static int xh[DSV_HPEL_NSEARCH] = { 1, -1, 0,  0, -1,  1, -1, 1 };
+            static int yh[DSV_HPEL_NSEARCH] = { 0,  0, 1, -1, -1, -1,  1, 1 };
             DSV_PLANE srcp;
             DSV_PLANE zerorefp;
             int dx, dy, bestdx, bestdy;
             int best, score;
             int bx, by, bw, bh;
             int k, xx, yy, m, n = 0;
-            DSV_MV *inherited[8];
+            DSV_MV *inherited[16];
+            DSV_MV temporal[5];
             DSV_MV best_mv = { 0 };
             
             best_mv.mode = DSV_MODE_INTER;
@@ -449,6 +654,29 @@ refine_level(DSV_HME *hme, int level)
             bw = MIN(srcp.w, y_w);
             bh = MIN(srcp.h, y_h);
             
+            /* nearly unchanged at zero motion, there is nothing to search */
+            if (level > 0 && hme->statics && all_static(hme, i, j, step) &&
+                unchanged(srcp.data, srcp.stride,
+                    zerorefp.data, zerorefp.stride, bw, bh, STATIC_DIF)) {
+                mf[i + j * nxb] = best_mv;
+                continue;
+            }
+            if (level == 0 && hme->statics && hme->statics[i + j * nxb]) {
+                /* the reference measured the detail flags on the same
+                 * pixels already */
+                mv = hme->ref_mvs ? &hme->ref_mvs[i + j * nxb] : NULL;
+                if (mv != NULL && mv->mode == DSV_MODE_INTER &&
+                    unchanged(srcp.data, srcp.stride,
+                        zerorefp.data, zerorefp.stride, bw, bh, STATIC_DIF)) {
+                    best_mv.lo_tex = mv->lo_tex;
+                    best_mv.lo_var = mv->lo_var;
+                    best_mv.high_detail = mv->high_detail;
+                    mf[i + j * nxb] = best_mv;
+                    nstatic++;
+                    continue;
+                }
+            }
+            
             inherited[n++] = &zero;
             if (parent != NULL) {
                 static int pt[5 * 2] = { 0, 0,  -2, 0,  2, 0,  0, -2,  0, 2 };
@@ -478,6 +706,49 @@ refine_level(DSV_HME *hme, int level)
                     }
                 }
             }
+            if (hme->seed != NULL) {
+                mv = &hme->seed[i + j * nxb];
+                if (mv->u.all) {
+                    for (k = 0; k < n; k++) {
+                        if (inherited[k]->u.all == mv->u.all) {
+                            break;
+                        }
+                    }
+                    if (k == n) {
+                        inherited[n++] = mv;
+                    }
+                }
+            }
+            if (hme->temporal && hme->ref_mvs != NULL) {
+                static int tt[5 * 2] = { 0, 0,  -1, 0,  1, 0,  0, -1,  0, 1 };
+                int x, y, nt = 0;
+                
+                for (m = 0; m < 5; m++) {
+                    x = i + tt[(m << 1) + 0] * step;
+                    y = j + tt[(m << 1) + 1] * step;
+                    if (x < 0 || x >= nxb || y < 0 || y >= nyb) {
+                        continue;
+                    }
+                    mv = &hme->ref_mvs[x + y * nxb];
+                    if (mv->mode != DSV_MODE_INTER) {
+                        continue;
+                    }
+                    /* same motion as the reference had to its own reference */
+                    temporal[nt].u.mv.x = mv->u.mv.x >> 1;
+                    temporal[nt].u.mv.y = mv->u.mv.y >> 1;
+                    if (temporal[nt].u.all == 0) {
+                        continue;
+                    }
+                    for (k = 0; k < n; k++) {
+                        if (inherited[k]->u.all == temporal[nt].u.all) {
+                            break;
+                        }
+                    }
+                    if (k == n) {
+                        inherited[n++] = &temporal[nt++];
+                    }
+                }
+            }
             /* find best inherited vector */ 
             best = n - 1;
             bestdx = inherited[best]->u.mv.x;
@@ -524,7 +795,7 @@ refine_level(DSV_HME *hme, int level)
             yy = by + dy;
             
             m = 0;
-            for (k = 0; k < FPEL_NSEARCH; k++) {
+            for (k = 0; k < ef->fpel_points; k++) {
                 score = fastsad(srcp.data, sp->stride,
                         DSV_GET_XY(rp, xx + xf[k], yy + yf[k]),
                         rp->stride, bw, bh);
@@ -542,14 +813,14 @@ refine_level(DSV_HME *hme, int level)
             
             /* hpel refine at base level */
             if (level == 0) {
-                static uint8_t refblock[DSV_MAX_BLOCK_SIZE * DSV_MAX_BLOCK_SIZE];
+                uint8_t refblock[DSV_MAX_BLOCK_SIZE * DSV_MAX_BLOCK_SIZE];
                 unsigned yarea = bw * bh;
                 unsigned yareasq = yarea * yarea;
                 int has_hp_block = 0;
                 
                 /* only if prediction is bad enough */
-                if (best > hpel_thresh) {
-                    static uint8_t tmp[(2 + HP_STRIDE) * (2 + HP_STRIDE)];
+                if (ef->hpel_points > 0 && best > hpel_thresh) {
+                    uint8_t tmp[(2 + HP_STRIDE) * (2 + HP_STRIDE)];
                     int best_hp;
                     DSV_PLANE srcp_h;
                     DSV_PLANE refp_h;
@@ -562,16 +833,36 @@ refine_level(DSV_HME *hme, int level)
                     dsv_plane_xy(src, &srcp_h, 0, xx, yy);
                     dsv_plane_xy(ref, &refp_h, 0, xx + mv->u.mv.x, yy + mv->u.mv.y);
                     m = -1;
-                    hpel(tmp, refp_h.data - 1 - refp_h.stride, refp_h.stride);
-                    
-                    /* start at (1, 1) */
-                    tmph = tmp + 2 + 2 * HP_STRIDE;
-                    for (k = 0; k < HPEL_NSEARCH; k++) {
-                        score = hpsad(srcp_h.data, srcp_h.stride,
-                                tmph + xh[k] + (yh[k] * HP_STRIDE));
-                        if (best_hp > score) {
-                            best_hp = score;
-                            m = k;
+                    xx += mv->u.mv.x;
+                    yy += mv->u.mv.y;
+                    if (hme->ref_hp && hp_fits(ref, xx, yy)) {
+                        uint8_t *hpb;
+                        int hps;
+                        
+                        /* built the first time a block gets this far */
+                        dsv_hpel_planes(ref, hme->ref_hp, 1, (1 << DSV_HP_PLANES) - 1);
+                        tmph = NULL;
+                        for (k = 0; k < ef->hpel_points; k++) {
+                            hpb = hp_block(hme->ref_hp, ref, xx, yy, xh[k], yh[k], &hps);
+                            score = sad_wxh(srcp_h.data, srcp_h.stride,
+                                    hpb, hps, HP_SAD_SZ, HP_SAD_SZ);
+                            if (best_hp > score) {
+                                best_hp = score;
+                                m = k;
+                            }
+                        }
+                    } else {
+                        hpel(tmp, refp_h.data - 1 - refp_h.stride, refp_h.stride);
+                        
+                        /* start at (1, 1) */
+                        tmph = tmp + 2 + 2 * HP_STRIDE;
+                        for (k = 0; k < ef->hpel_points; k++) {
+                            score = hpsad(srcp_h.data, srcp_h.stride,
+                                    tmph + xh[k] + (yh[k] * HP_STRIDE));
+                            if (best_hp > score) {
+                                best_hp = score;
+                                m = k;
+                            }
                         }
                     }
                     mv->u.mv.x <<= 1;
@@ -579,9 +870,18 @@ refine_level(DSV_HME *hme, int level)
                     if (m != -1) {
                         mv->u.mv.x += xh[m];
                         mv->u.mv.y += yh[m];
-                        hpcpy(refblock, DSV_MAX_BLOCK_SIZE, tmph + xh[m] + (yh[m] * HP_STRIDE));
+                        if (tmph == NULL) {
+                            uint8_t *hpb;
+                            int hps;
+                            
+                            hpb = hp_block(hme->ref_hp, ref, xx, yy, xh[m], yh[m], &hps);
+                            fpcpy(refblock, DSV_MAX_BLOCK_SIZE, hpb, hps);
+                        } else {
+                            hpcpy(refblock, DSV_MAX_BLOCK_SIZE, tmph + xh[m] + (yh[m] * HP_STRIDE));
+                        }
                         has_hp_block = 1;
                         best = best_hp * yarea / (HP_SAD_SZ * HP_SAD_SZ);
+                        nhit++;
                     }
                     nhp++;
                 } else {
@@ -589,7 +889,7 @@ refine_level(DSV_HME *hme, int level)
                     mv->u.mv.x <<= 1;
                     mv->u.mv.y <<= 1;
                 }
-                if (!has_hp_block) { /* use full pel ref */
+                if (!has_hp_block && ef->intra) { /* use full pel ref */
                     DSV_PLANE refp;
                     xx = bx + ((bw >> 1) - (HP_SAD_SZ / 2));
                     yy = by + ((bh >> 1) - (HP_SAD_SZ / 2));
@@ -603,6 +903,7 @@ refine_level(DSV_HME *hme, int level)
                     int src_var, ref_var;
                     int src_tex, ref_tex;
                     DSV_MV *pmv;
+                    DSV_BLKSTAT *srcst, *refst;
                     unsigned thresh_tex = 1;
                     int thresh_var = HP_SAD_SZ * HP_SAD_SZ;
                     
@@ -611,12 +912,21 @@ refine_level(DSV_HME *hme, int level)
                     dsv_plane_xy(src, &srcp_l, 0, xx, yy);
                     
                     ubest = best;
-                    luma_var = block_analysis(&srcp, bw, bh, &luma_tex);
+                    srcst = &hme->src_stats[i + j * nxb];
+                    refst = &hme->ref_stats[i + j * nxb];
+                    luma_var = fast_analysis(&srcp, bw, bh, &luma_tex, &srcst->avg);
+                    srcst->var = luma_var;
+                    srcst->known |= DSV_BLKSTAT_VAR | DSV_BLKSTAT_AVG;
                     mv->lo_tex = (luma_tex <= 2);
                     mv->lo_var = (luma_var < yareasq);
                     
                     src_tex = block_texture(srcp_l.data, srcp_l.stride, &src_avg, &src_var);
-                    ref_tex = block_texture(refblock, DSV_MAX_BLOCK_SIZE, &ref_avg, &ref_var);
+                    ref_tex = 0;
+                    ref_avg = src_avg;
+                    ref_var = 0;
+                    if (ef->intra) { /* only needed for the intra decision */
+                        ref_tex = block_texture(refblock, DSV_MAX_BLOCK_SIZE, &ref_avg, &ref_var);
+                    }
                     /* use neighboring blocks to help estimate its detail importance */
                     if (i > 0) {
                         pmv = (mf + j * nxb + (i - 1));
@@ -649,7 +959,10 @@ refine_level(DSV_HME *hme, int level)
                     
                     /* using gotos to make it a bit easier to read (for myself) */
 #if 1 /* have intra blocks */
-                    if (src_tex < 2 && y_sqrvar(&zerorefp, bw, bh) > (luma_var * 2)) {
+                    if (!ef->intra) {
+                        goto inter;
+                    }
+                    if (src_tex < 2 && stat_var(refst, &zerorefp, bw, bh) > (luma_var * 2)) {
                         goto intra;
                     }
                     if (ref_var > (src_var * 2)) {
@@ -665,7 +978,7 @@ refine_level(DSV_HME *hme, int level)
                         goto intra;
                     }
 #if 1 /* chroma check */
-                    {
+                    if (ef->intra > 1) {
                         int cbx, cby, subsamp;
                         unsigned cbw, cbh, cvarS, cvarR;
                         subsamp = params->vidmeta->subsamp;
@@ -673,8 +986,8 @@ refine_level(DSV_HME *hme, int level)
                         cby = j * (y_h >> DSV_FORMAT_V_SHIFT(subsamp));
                         cbw = bw >> DSV_FORMAT_H_SHIFT(subsamp);
                         cbh = bh >> DSV_FORMAT_V_SHIFT(subsamp);
-                        cvarS = c_maxvar(sp, cbx, cby, cbw, cbh);
-                        cvarR = c_maxvar(rp, cbx, cby, cbw, cbh);
+                        cvarS = stat_cvar(srcst, sp, cbx, cby, cbw, cbh);
+                        cvarR = stat_cvar(refst, rp, cbx, cby, cbw, cbh);
                         if (cvarR > (4 * cvarS)) {
                             goto intra;
                         }
@@ -682,13 +995,14 @@ refine_level(DSV_HME *hme, int level)
 #endif
                     goto inter;
 intra:
-                    if (block_intra_test(&srcp, &zerorefp, bw, bh)) {
+                    if (block_intra_test(&srcp, stat_avg(refst, &zerorefp, bw, bh), bw, bh)) {
                         goto inter;
                     }
                     /* do extra checks for 4 quadrants */
                     mv->submask = DSV_MASK_ALL_INTRA;
-                    /* don't give low texture intra blocks the opportunity to cause trouble */
-                    if (src_tex > 1) {
+                    /* don't give low texture intra blocks the opportunity to cause trouble,
+                     * edge blocks can also be too small in chroma to be split */
+                    if (ef->intra_split && src_tex > 1 && subblocks_fit(params, bw, bh)) {
                         int f, g, sbw, sbh, mask_index;
                         uint8_t masks[4] = {
                                 ~DSV_MASK_INTRA00,
@@ -713,6 +1027,12 @@ intra:
                     if (mv->submask) {
                         mv->mode = DSV_MODE_INTRA;
                         nintra++;
+                        if (hme->intra_thresh >= 0 &&
+                            (nintra * 100) / (nxb * nyb) > hme->intra_thresh) {
+                            /* it will be an I frame, the rest is wasted */
+                            hme->promoted = 1;
+                            goto done;
+                        }
                     }
 inter:
                     ;
@@ -721,8 +1041,13 @@ inter:
             }
         }
     }
+done:
     if (level == 0) {
         DSV_DEBUG(("num half pel: %d num skipped: %d", nhp, nsk));
+        hme->hpel_searched = nhp;
+        hme->hpel_skipped = nsk;
+        hme->hpel_hits = nhit;
+        hme->static_blocks = nstatic;
     }
     return nintra;
 }
@@ -733,10 +1058,22 @@ dsv_hme(DSV_HME *hme)
     int i = hme->levels;
     int nintra = 0;
 
-    while (i >= 0) {
+    hme->promoted = 0;
+    hme->static_blocks = 0;
+    hme->statics = NULL;
+    if (hme->effort->static_skip) {
+        hme->statics = dsv_alloc_tag(hme->params->nblocks_h * hme->params->nblocks_v, DSV_MEM_MOTION);
+        find_statics(hme);
+    }
+    while (i >= 0 && !hme->promoted) {
         nintra = refine_level(hme, i);
         i--;
     }
+    if (hme->statics) {
+        dsv_free(hme->statics);
+        hme->statics = NULL;
+    }
+    hme->nintra = nintra;
     return (nintra * 100) / (hme->params->nblocks_h * hme->params->nblocks_v);
 }
 
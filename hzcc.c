@@ -305,6 +305,8 @@ hzcc_dec(DSV_BS *bs, unsigned bufsz, DSV_COEFS *dst, int q, DSV_STABILITY *stab)
     DSV_SBC *outp;
     int w = dst->width;
     int h = dst->height;
+    /* levels from here on are only needed at full size */
+    int top = DSV_MAXLVL - stab->params->scale;
     
     dsv_bs_align(bs);
     runs = dsv_bs_get_bits(bs, 32);
@@ -343,7 +345,7 @@ hzcc_dec(DSV_BS *bs, unsigned bufsz, DSV_COEFS *dst, int q, DSV_STABILITY *stab)
         outp += w;
     }
 
-    for (l = 0; l < DSV_MAXLVL; l++) {
+    for (l = 0; l < top; l++) {
         unsigned char *blockrow;
         int tmq;
         
@@ -486,8 +488,8 @@ dsv_decode_plane(uint8_t *in, unsigned s, DSV_COEFS *dst, int q, DSV_STABILITY *
     LL = dsv_bs_get_seg(&bs);
     hzcc_dec(&bs, s, dst, q, stab);
 
-    /* error detection */
-    if (dsv_bs_get_bits(&bs, 8) != EOP_SYMBOL) {
+    /* error detection, the end is not reached when levels were skipped */
+    if (stab->params->scale == 0 && dsv_bs_get_bits(&bs, 8) != EOP_SYMBOL) {
         DSV_ERROR(("bad eop, frame data incomplete and/or corrupt"));
     }
     dsv_bs_align(&bs);
@@ -0,0 +1,463 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+/* for the optional POSIX facilities, must come before any system header */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+/* 64 bit off_t for fseeko / ftello where long is 32 bits */
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include "platform.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#if DSV_MT
+#include <pthread.h>
+
+struct DSV_THREAD {
+    pthread_t handle;
+    void (*func)(void *);
+    void *arg;
+};
+
+struct DSV_MUTEX {
+    pthread_mutex_t handle;
+};
+
+struct DSV_COND {
+    pthread_cond_t handle;
+};
+
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *
+thread_main(void *p)
+{
+    DSV_THREAD *t = p;
+
+    t->func(t->arg);
+    return NULL;
+}
+
+extern DSV_THREAD *
+dsv_thread_start(void (*func)(void *), void *arg)
+{
+    DSV_THREAD *t;
+
+    t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->func = func;
+    t->arg = arg;
+    if (pthread_create(&t->handle, NULL, thread_main, t)) {
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+extern void
+dsv_thread_join(DSV_THREAD *t)
+{
+    if (t) {
+        pthread_join(t->handle, NULL);
+        free(t);
+    }
+}
+
+extern DSV_MUTEX *
+dsv_mutex_new(void)
+{
+    DSV_MUTEX *m;
+
+    m = calloc(1, sizeof(*m));
+    if (m) {
+        pthread_mutex_init(&m->handle, NULL);
+    }
+    return m;
+}
+
+extern void
+dsv_mutex_lock(DSV_MUTEX *m)
+{
+    if (m) {
+        pthread_mutex_lock(&m->handle);
+    }
+}
+
+extern void
+dsv_mutex_unlock(DSV_MUTEX *m)
+{
+    if (m) {
+        pthread_mutex_unlock(&m->handle);
+    }
+}
+
+extern void
+dsv_mutex_free(DSV_MUTEX *m)
+{
+    if (m) {
+        pthread_mutex_destroy(&m->handle);
+        free(m);
+    }
+}
+
+extern DSV_COND *
+dsv_cond_new(void)
+{
+    DSV_COND *c;
+
+    c = calloc(1, sizeof(*c));
+    if (c) {
+        pthread_cond_init(&c->handle, NULL);
+    }
+    return c;
+}
+
+extern void
+dsv_cond_wait(DSV_COND *c, DSV_MUTEX *m)
+{
+    if (c && m) {
+        pthread_cond_wait(&c->handle, &m->handle);
+    }
+}
+
+extern void
+dsv_cond_signal(DSV_COND *c)
+{
+    if (c) {
+        pthread_cond_signal(&c->handle);
+    }
+}
+
+extern void
+dsv_cond_broadcast(DSV_COND *c)
+{
+    if (c) {
+        pthread_cond_broadcast(&c->handle);
+    }
+}
+
+extern void
+dsv_cond_free(DSV_COND *c)
+{
+    if (c) {
+        pthread_cond_destroy(&c->handle);
+        free(c);
+    }
+}
+
+extern void
+dsv_global_lock(void)
+{
+    pthread_mutex_lock(&global_lock);
+}
+
+extern void
+dsv_global_unlock(void)
+{
+    pthread_mutex_unlock(&global_lock);
+}
+#else
+extern DSV_THREAD *
+dsv_thread_start(void (*func)(void *), void *arg)
+{
+    (void) func;
+    (void) arg;
+    return NULL;
+}
+
+extern void
+dsv_thread_join(DSV_THREAD *t)
+{
+    (void) t;
+}
+
+extern DSV_MUTEX *
+dsv_mutex_new(void)
+{
+    return NULL;
+}
+
+extern void
+dsv_mutex_lock(DSV_MUTEX *m)
+{
+    (void) m;
+}
+
+extern void
+dsv_mutex_unlock(DSV_MUTEX *m)
+{
+    (void) m;
+}
+
+extern void
+dsv_mutex_free(DSV_MUTEX *m)
+{
+    (void) m;
+}
+
+extern DSV_COND *
+dsv_cond_new(void)
+{
+    return NULL;
+}
+
+extern void
+dsv_cond_wait(DSV_COND *c, DSV_MUTEX *m)
+{
+    (void) c;
+    (void) m;
+}
+
+extern void
+dsv_cond_signal(DSV_COND *c)
+{
+    (void) c;
+}
+
+extern void
+dsv_cond_broadcast(DSV_COND *c)
+{
+    (void) c;
+}
+
+extern void
+dsv_cond_free(DSV_COND *c)
+{
+    (void) c;
+}
+
+extern void
+dsv_global_lock(void)
+{
+}
+
+extern void
+dsv_global_unlock(void)
+{
+}
+#endif
+
+struct PARALLEL_ARG {
+    void (*func)(void *, int);
+    void *arg;
+    int idx;
+};
+
+static void
+parallel_main(void *p)
+{
+    struct PARALLEL_ARG *pa = p;
+
+    pa->func(pa->arg, pa->idx);
+}
+
+extern void
+dsv_parallel(int n, void (*func)(void *, int), void *arg)
+{
+    struct PARALLEL_ARG *pa;
+    DSV_THREAD **threads;
+    int i;
+
+    pa = calloc(n, sizeof(*pa));
+    threads = calloc(n, sizeof(*threads));
+    if (pa == NULL || threads == NULL) {
+        n = 0;
+    }
+    for (i = 1; i < n; i++) {
+        pa[i].func = func;
+        pa[i].arg = arg;
+        pa[i].idx = i;
+        threads[i] = dsv_thread_start(parallel_main, &pa[i]);
+    }
+    func(arg, 0);
+    for (i = 1; i < n; i++) {
+        if (threads[i]) {
+            dsv_thread_join(threads[i]);
+        } else {
+            func(arg, i); /* could not start a thread for it */
+        }
+    }
+    if (pa) {
+        free(pa);
+    }
+    if (threads) {
+        free(threads);
+    }
+}
+
+#if DSV_MT
+extern unsigned long
+dsv_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long) ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+#else
+extern unsigned long
+dsv_usec(void)
+{
+    return (unsigned long) ((uint64_t) clock() * 1000000 / CLOCKS_PER_SEC);
+}
+#endif
+
+#if DSV_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+extern void *
+dsv_map_file(FILE *f, size_t *len)
+{
+    struct stat st;
+    void *p;
+    int fd;
+
+    fd = fileno(f);
+    if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        return NULL;
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    *len = st.st_size;
+    return p;
+}
+
+extern void
+dsv_unmap_file(void *p, size_t len)
+{
+    if (p) {
+        munmap(p, len);
+    }
+}
+#else
+extern void *
+dsv_map_file(FILE *f, size_t *len)
+{
+    (void) f;
+    (void) len;
+    return NULL;
+}
+
+extern void
+dsv_unmap_file(void *p, size_t len)
+{
+    (void) p;
+    (void) len;
+}
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+extern int
+dsv_fseek(FILE *f, DSV_OFF off, int whence)
+{
+    return _fseeki64(f, off, whence);
+}
+
+extern DSV_OFF
+dsv_ftell(FILE *f)
+{
+    return _ftelli64(f);
+}
+#elif defined(_POSIX_VERSION) && _POSIX_VERSION >= 200112L
+#include <sys/types.h>
+
+extern int
+dsv_fseek(FILE *f, DSV_OFF off, int whence)
+{
+    if ((off_t) off != off) {
+        return -1;
+    }
+    return fseeko(f, (off_t) off, whence);
+}
+
+extern DSV_OFF
+dsv_ftell(FILE *f)
+{
+    return ftello(f);
+}
+#else
+#include <limits.h>
+
+extern int
+dsv_fseek(FILE *f, DSV_OFF off, int whence)
+{
+    if (off > LONG_MAX || off < LONG_MIN) {
+        return -1;
+    }
+    return fseek(f, (long) off, whence);
+}
+
+extern DSV_OFF
+dsv_ftell(FILE *f)
+{
+    return ftell(f);
+}
+#endif
+
+extern char *
+dsv_off_str(DSV_OFF off, char *buf)
+{
+    char *p = buf + DSV_OFF_STRLEN - 1;
+    uint64_t v = off < 0 ? -(uint64_t) off : (uint64_t) off;
+
+    *p = '\0';
+    do {
+        *--p = '0' + (int) (v % 10);
+        v /= 10;
+    } while (v);
+    if (off < 0) {
+        *--p = '-';
+    }
+    return p;
+}
+
+#if DSV_SIMD && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+extern int
+dsv_cpu_features(void)
+{
+    int f = 0;
+    
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        f |= DSV_CPU_SSE2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        f |= DSV_CPU_AVX2;
+    }
+    return f;
+}
+#else
+extern int
+dsv_cpu_features(void)
+{
+    return 0;
+}
+#endif
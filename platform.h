@@ -0,0 +1,112 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+#ifndef _PLATFORM_H_
+#define _PLATFORM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Optional OS facilities.
+ *
+ * Nothing in here is required by the codec, by default everything compiles
+ * down to plain C standard library code. The following can be defined to 1
+ * at compile time to make use of the operating system (POSIX only) or the
+ * processor:
+ *
+ *   DSV_MT   - threads (link with -lpthread)
+ *   DSV_MMAP - memory mapped input files
+ *   DSV_SIMD - SSE2 / AVX2 motion compensation kernels on x86 with GCC or
+ *              Clang, picked at run time based on what the processor has.
+ *              the output is exactly the same as without it
+ */
+#ifndef DSV_MT
+#define DSV_MT 0
+#endif
+#ifndef DSV_MMAP
+#define DSV_MMAP 0
+#endif
+#ifndef DSV_SIMD
+#define DSV_SIMD 0
+#endif
+
+typedef struct DSV_THREAD DSV_THREAD;
+typedef struct DSV_MUTEX DSV_MUTEX;
+typedef struct DSV_COND DSV_COND;
+
+/* returns NULL if the thread could not be started (or DSV_MT is 0),
+ * the caller is expected to do the work itself in that case */
+extern DSV_THREAD *dsv_thread_start(void (*func)(void *), void *arg);
+extern void dsv_thread_join(DSV_THREAD *t);
+
+/* all of these are no-ops when DSV_MT is 0 */
+extern DSV_MUTEX *dsv_mutex_new(void);
+extern void dsv_mutex_lock(DSV_MUTEX *m);
+extern void dsv_mutex_unlock(DSV_MUTEX *m);
+extern void dsv_mutex_free(DSV_MUTEX *m);
+
+extern DSV_COND *dsv_cond_new(void);
+extern void dsv_cond_wait(DSV_COND *c, DSV_MUTEX *m);
+extern void dsv_cond_signal(DSV_COND *c);
+extern void dsv_cond_broadcast(DSV_COND *c);
+extern void dsv_cond_free(DSV_COND *c);
+
+/* one process wide lock for the few pieces of global state in the codec */
+extern void dsv_global_lock(void);
+extern void dsv_global_unlock(void);
+
+/* calls func(arg, i) for i = 0...n-1, each on its own thread when possible.
+ * func(arg, 0) is run on the calling thread. returns once all are done. */
+extern void dsv_parallel(int n, void (*func)(void *, int), void *arg);
+
+/* microsecond counter for timing, wraps around so only differences mean
+ * anything. wall clock time with DSV_MT, otherwise processor time (which
+ * is the same thing for single threaded work) */
+extern unsigned long dsv_usec(void);
+
+/* map an entire file read-only, returns NULL if the file is not a regular
+ * file, could not be mapped, or DSV_MMAP is 0 */
+extern void *dsv_map_file(FILE *f, size_t *len);
+extern void dsv_unmap_file(void *p, size_t len);
+
+/* file offsets that reach past 2 GB even where long is 32 bits, through
+ * fseeko / ftello on POSIX and _fseeki64 / _ftelli64 on Windows. anywhere
+ * else it is plain fseek / ftell, which fail past LONG_MAX.
+ * same return values as fseek / ftell */
+typedef int64_t DSV_OFF;
+extern int dsv_fseek(FILE *f, DSV_OFF off, int whence);
+extern DSV_OFF dsv_ftell(FILE *f);
+/* writes off in decimal to buf (DSV_OFF_STRLEN bytes) and returns it,
+ * C89 printf has no 64 bit conversion */
+#define DSV_OFF_STRLEN 24
+extern char *dsv_off_str(DSV_OFF off, char *buf);
+
+/* instruction set extensions the processor has,
+ * always 0 when DSV_SIMD is 0 or the processor is not x86 */
+#define DSV_CPU_SSE2 1
+#define DSV_CPU_AVX2 2
+extern int dsv_cpu_features(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -27,25 +27,18 @@
  * Haar used for everything else
  */
 
-static DSV_SBC *temp_buf = NULL;
-static int temp_bufsz = 0;
-
-static void
+/* scratch memory is allocated per call so separate encoders / decoders
+ * can run at the same time */
+static DSV_SBC *
 alloc_temp(int size)
 {
-    if (temp_bufsz < size) {
-        temp_bufsz = size;
-        
-        if (temp_buf) {
-            dsv_free(temp_buf);
-            temp_buf = NULL;
-        }
+    DSV_SBC *temp_buf;
 
-        temp_buf = dsv_alloc(temp_bufsz * sizeof(DSV_SBC));
-        if (temp_buf == NULL) {
-            DSV_ERROR(("out of memory"));
-        }
+    temp_buf = dsv_alloc_tag(size * sizeof(DSV_SBC), DSV_MEM_SCRATCH);
+    if (temp_buf == NULL) {
+        DSV_ERROR(("out of memory"));
     }
+    return temp_buf;
 }
 
 static void
@@ -613,6 +606,87 @@ sbc2int(DSV_PLANE *p, DSV_COEFS *dc)
     }
 }
 
+/* the LL subband of level 'lvl' as pixels, each LL coefficient is the sum
+ * of the 4^lvl pixels it covers, FWD_SCALEd once for every level above 1 */
+static int
+ll2pix(int v, int lvl)
+{
+    int i, sh, half;
+
+    for (i = 1; i < lvl; i++) {
+        v = INV_SCALE(v);
+    }
+    sh = 2 * lvl;
+    half = 1 << (sh - 1);
+    if (v < 0) {
+        return -((half - v) >> sh);
+    }
+    return (v + half) >> sh;
+}
+
+/* the B4T low band is sharper than an average of the pixels it covers,
+ * an intra LL gets a [1 k 1] blur that approximately undoes that,
+ * with k = 2^(lvl+1)+2 since the Haar levels above halve the effect */
+static void
+ll2int(DSV_PLANE *p, DSV_COEFS *dc, int lvl, int isP)
+{
+    int x, y, w, h, v, k, n;
+    DSV_SBC *d;
+    DSV_SBC *tmp;
+    
+    d = dc->data;
+    w = p->w;
+    h = p->h;
+    if (isP || w < 2 || h < 2) {
+        for (y = 0; y < h; y++) {
+            uint8_t *line = DSV_GET_LINE(p, y);
+            for (x = 0; x < w; x++) {
+                v = ll2pix(d[x], lvl) + 128;
+                line[x] = v > 255 ? 255 : v < 0 ? 0 : v;
+            }
+            d += dc->width;
+        }
+        return;
+    }
+    k = (1 << (lvl + 1)) + 2;
+    n = k + 2;
+    tmp = alloc_temp(w * h);
+    for (y = 0; y < h; y++) {
+        DSV_SBC *t = tmp + y * w;
+        for (x = 0; x < w; x++) {
+            t[x] = ll2pix(d[x], lvl);
+        }
+        d += dc->width;
+    }
+    for (y = 0; y < h; y++) {
+        DSV_SBC *t = tmp + y * w;
+        int prev = t[0];
+        for (x = 0; x < w; x++) {
+            int cur = t[x];
+            int next = t[x + (x < w - 1)];
+            t[x] = prev + k * cur + next;
+            prev = cur;
+        }
+    }
+    for (y = 0; y < h; y++) {
+        uint8_t *line = DSV_GET_LINE(p, y);
+        DSV_SBC *t = tmp + y * w;
+        DSV_SBC *a = t - (y > 0) * w;
+        DSV_SBC *b = t + (y < h - 1) * w;
+        for (x = 0; x < w; x++) {
+            v = a[x] + k * t[x] + b[x];
+            if (v < 0) {
+                v = -((n * n / 2 - v) / (n * n));
+            } else {
+                v = (v + n * n / 2) / (n * n);
+            }
+            v += 128;
+            line[x] = v > 255 ? 255 : v < 0 ? 0 : v;
+        }
+    }
+    dsv_free(tmp);
+}
+
 /* C.3.3 Subband Recomposition - num_levels */
 static int
 nlevels(int w, int h)
@@ -633,13 +707,13 @@ dsv_fwd_sbt(DSV_PLANE *src, DSV_COEFS *dst, int isP)
     int lvls, i;
     int w = dst->width;
     int h = dst->height;
-    DSV_SBC *temp_buf_pad;
+    DSV_SBC *temp_buf, *temp_buf_pad;
 
     p2sbc(dst, src);
     
     lvls = nlevels(w, h);
 
-    alloc_temp((w + 2) * (h + 2));
+    temp_buf = alloc_temp((w + 2) * (h + 2));
     temp_buf_pad = temp_buf + w;
     for (i = 1; i <= lvls; i++) {
         if (!isP && i == 1) {
@@ -648,20 +722,21 @@ dsv_fwd_sbt(DSV_PLANE *src, DSV_COEFS *dst, int isP)
             fwd(dst->data, temp_buf_pad, w, h, i, !isP);
         }
     }
+    dsv_free(temp_buf);
 }
 
 /* C.3.3 Subband Recomposition */
 extern void
-dsv_inv_sbt(DSV_PLANE *dst, DSV_COEFS *src, int q, int isP, int c)
+dsv_inv_sbt(DSV_PLANE *dst, DSV_COEFS *src, int q, int isP, int c, int scale)
 {
     int lvls, i;
     int w = src->width;
     int h = src->height;
-    DSV_SBC *temp_buf_pad;
+    DSV_SBC *temp_buf, *temp_buf_pad;
 
     lvls = nlevels(w, h);
 
-    alloc_temp((w + 2) * (h + 2));
+    temp_buf = alloc_temp((w + 2) * (h + 2));
 
     temp_buf_pad = temp_buf + w;
     if (c == 0) {
@@ -675,7 +750,7 @@ dsv_inv_sbt(DSV_PLANE *dst, DSV_COEFS *src, int q, int isP, int c)
          * noticed when improperly filtered.
          */
         llq = dsv_get_quant(q, isP, 0) / 2;
-        for (i = lvls; i > 0; i--) {
+        for (i = lvls; i > scale; i--) {
             /* C.3.1.4 get_HQP */
             int hqp;
             if (i > 3) {
@@ -701,7 +776,7 @@ dsv_inv_sbt(DSV_PLANE *dst, DSV_COEFS *src, int q, int isP, int c)
             }
         }
     } else {
-        for (i = lvls; i > 0; i--) {
+        for (i = lvls; i > scale; i--) {
             if (!isP && i == 1) {
                 inv_b4t_2d(temp_buf_pad, src->data, w, h);
             } else {
@@ -709,6 +784,11 @@ dsv_inv_sbt(DSV_PLANE *dst, DSV_COEFS *src, int q, int isP, int c)
             }
         }
     }
+    dsv_free(temp_buf);
 
-    sbc2int(dst, src);
+    if (scale > 0) {
+        ll2int(dst, src, scale, isP);
+    } else {
+        sbc2int(dst, src);
+    }
 }
@@ -0,0 +1,192 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+#include "synth.h"
+
+static char *names[SYNTH_NPATTERNS] = {
+    "none", "gradient", "pan", "noise", "cuts", "screen", "mix"
+};
+
+extern char *
+synth_name(int pattern)
+{
+    if (pattern < 0 || pattern >= SYNTH_NPATTERNS) {
+        return "unknown";
+    }
+    return names[pattern];
+}
+
+static uint32_t
+hash(uint32_t x, uint32_t y, uint32_t seed)
+{
+    uint32_t h;
+    
+    h = x * 374761393u + y * 668265263u + seed * 2246822519u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    return h ^ (h >> 16);
+}
+
+/* bilinearly interpolated random values on a grid of (1 << shift) */
+static int
+vnoise(uint32_t x, uint32_t y, int shift, uint32_t seed)
+{
+    uint32_t cx, cy, fx, fy, s, a, b, c, d, top, bot;
+    
+    s = 1 << shift;
+    cx = x >> shift;
+    cy = y >> shift;
+    fx = x & (s - 1);
+    fy = y & (s - 1);
+    a = hash(cx, cy, seed) & 0xff;
+    b = hash(cx + 1, cy, seed) & 0xff;
+    c = hash(cx, cy + 1, seed) & 0xff;
+    d = hash(cx + 1, cy + 1, seed) & 0xff;
+    top = a * (s - fx) + b * fx;
+    bot = c * (s - fx) + d * fx;
+    return (top * (s - fy) + bot * fy) >> (2 * shift);
+}
+
+/* 0...255...0 over a period of 512 */
+static int
+tri(int v)
+{
+    v &= 511;
+    return v > 255 ? 511 - v : v;
+}
+
+struct SCENE {
+    int w, h;
+    int sx, sy; /* pixels per gradient step */
+    unsigned fno;
+    uint32_t seed;
+};
+
+static int
+gradient(struct SCENE *s, int c, int x, int y)
+{
+    int gx = x / s->sx + 3 * s->fno + 97 * s->seed;
+    int gy = y / s->sy + 2 * s->fno;
+    
+    switch (c) {
+        case 0:
+            return tri((gx + gy) >> 1);
+        case 1:
+            return 64 + (tri(gx + 64) >> 1);
+    }
+    return 64 + (tri(gy - gx + 128) >> 1);
+}
+
+static int
+pan(struct SCENE *s, int c, int x, int y)
+{
+    uint32_t px = x + 3 * s->fno + 4096;
+    uint32_t py = y + s->fno + 4096;
+    
+    if (c == 0) {
+        return (vnoise(px, py, 5, s->seed) * 3 + vnoise(px, py, 2, s->seed + 1)) >> 2;
+    }
+    return 64 + (vnoise(px, py, 6, s->seed + 1 + c) >> 1);
+}
+
+static int
+noise(struct SCENE *s, int c, int x, int y)
+{
+    return hash(x, y, s->fno * 3 + c) & 0xff;
+}
+
+static int
+screen(struct SCENE *s, int c, int x, int y)
+{
+    uint32_t tile = hash(x >> 6, y >> 6, s->seed);
+    int cx = (s->fno * 4) % s->w;
+    int cy = s->h / 2;
+    int line;
+    
+    if (x >= cx && x < cx + 16 && y >= cy && y < cy + 16) {
+        return c ? 128 : 255; /* cursor */
+    }
+    if (c) {
+        return 96 + ((tile >> (8 * c)) & 63);
+    }
+    switch (tile & 3) {
+        case 0: /* flat window */
+            return 160 + ((tile >> 8) & 95);
+        case 1: /* text */
+            line = y & 15;
+            if (line < 11 && (x & 7) < 6 &&
+                    ((hash(x >> 3, y >> 4, s->seed) >> ((x & 7) + 6 * (line >> 1))) & 1)) {
+                return 20;
+            }
+            return 235;
+        case 2: /* toolbar */
+            return 96 + (y & 63);
+    }
+    return 40;
+}
+
+static int
+sample(struct SCENE *s, int pattern, int c, int x, int y)
+{
+    switch (pattern) {
+        case SYNTH_GRADIENT:
+            return gradient(s, c, x, y);
+        case SYNTH_PAN:
+            return pan(s, c, x, y);
+        case SYNTH_NOISE:
+            return noise(s, c, x, y);
+        case SYNTH_SCREEN:
+            return screen(s, c, x, y);
+    }
+    return 128;
+}
+
+extern void
+synth_frame(DSV_FRAME *f, int pattern, unsigned fno)
+{
+    static int cuts[3] = { SYNTH_GRADIENT, SYNTH_PAN, SYNTH_SCREEN };
+    struct SCENE s;
+    int c, x, y, p;
+    
+    s.w = f->width;
+    s.h = f->height;
+    s.sx = (s.w + 255) / 256;
+    s.sy = (s.h + 255) / 256;
+    s.fno = fno;
+    s.seed = 0;
+    if (pattern == SYNTH_CUTS) {
+        s.seed = fno / SYNTH_SCENE_LEN;
+        pattern = cuts[s.seed % 3];
+    }
+    for (c = 0; c < 3; c++) {
+        DSV_PLANE *pl = f->planes + c;
+        
+        for (y = 0; y < pl->h; y++) {
+            uint8_t *line = DSV_GET_LINE(pl, y);
+            int ly = y << pl->vs; /* position in luma */
+            
+            for (x = 0; x < pl->w; x++) {
+                int lx = x << pl->hs;
+                
+                p = pattern;
+                if (pattern == SYNTH_MIX) {
+                    p = 1 + (lx >= s.w / 2) + 2 * (ly >= s.h / 2);
+                    p = (p == 3) ? SYNTH_SCREEN : (p == 4) ? SYNTH_NOISE : p;
+                }
+                line[x] = sample(&s, p, c, lx, ly);
+            }
+        }
+    }
+}
@@ -0,0 +1,52 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+#ifndef _SYNTH_H_
+#define _SYNTH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "dsv.h"
+
+/* Synthetic Test Sequences
+ *
+ * every frame is a pure function of the pattern, frame number and size so
+ * sequences are the same on every machine and frames can be generated in
+ * any order.
+ */
+#define SYNTH_NONE     0
+#define SYNTH_GRADIENT 1 /* smooth gradients moving in different directions */
+#define SYNTH_PAN      2 /* detailed texture panning across the frame */
+#define SYNTH_NOISE    3 /* uncorrelated noise, worst case for everything */
+#define SYNTH_CUTS     4 /* the above (minus noise) with a cut every scene */
+#define SYNTH_SCREEN   5 /* mostly static screen content, a moving cursor */
+#define SYNTH_MIX      6 /* gradient, pan, screen, noise in four quadrants */
+#define SYNTH_NPATTERNS 7
+
+#define SYNTH_SCENE_LEN 30 /* frames between scene cuts */
+#define SYNTH_DEFAULT_LEN 300 /* frames in a sequence unless told otherwise */
+
+extern char *synth_name(int pattern);
+/* fill every plane of a frame with frame number fno of the pattern */
+extern void synth_frame(DSV_FRAME *f, int pattern, unsigned fno);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
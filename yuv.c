@@ -0,0 +1,527 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+#include "yuv.h"
+#include "synth.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+extern size_t
+yuv_frame_size(int w, int h, int subsamp)
+{
+    size_t cw, ch;
+
+    switch (subsamp) {
+        case DSV_SUBSAMP_444:
+        case DSV_SUBSAMP_422:
+        case DSV_SUBSAMP_420:
+        case DSV_SUBSAMP_411:
+            /* chroma planes rounded up, as dsv_load_planar_frame reads
+             * them and dsv_yuv_write writes them */
+            cw = DSV_ROUND_SHIFT(w, DSV_FORMAT_H_SHIFT(subsamp));
+            ch = DSV_ROUND_SHIFT(h, DSV_FORMAT_V_SHIFT(subsamp));
+            return (size_t) w * h + 2 * cw * ch;
+    }
+    return 0;
+}
+
+static int
+read_whole(FILE *f, uint8_t *dst, size_t n)
+{
+    return fread(dst, 1, n, f) == n;
+}
+
+static void
+readahead(void *arg)
+{
+    YUV_READER *r = arg;
+    uint8_t *dst;
+    int ok;
+
+    while (1) {
+        dsv_mutex_lock(r->lock);
+        while (!r->stop && (r->nread - r->nused) >= YUV_RA_FRAMES) {
+            dsv_cond_wait(r->cond, r->lock);
+        }
+        if (r->stop) {
+            dsv_mutex_unlock(r->lock);
+            break;
+        }
+        dst = r->slots[r->nread % YUV_RA_FRAMES];
+        dsv_mutex_unlock(r->lock);
+
+        ok = read_whole(r->fp, dst, r->framesz);
+
+        dsv_mutex_lock(r->lock);
+        if (ok) {
+            r->nread++;
+        } else {
+            r->eof = 1;
+        }
+        dsv_cond_broadcast(r->cond);
+        dsv_mutex_unlock(r->lock);
+        if (!ok) {
+            break;
+        }
+    }
+}
+
+static int
+start_readahead(YUV_READER *r)
+{
+    int i;
+
+    r->lock = dsv_mutex_new();
+    r->cond = dsv_cond_new();
+    if (r->lock == NULL || r->cond == NULL) {
+        goto fail;
+    }
+    for (i = 0; i < YUV_RA_FRAMES; i++) {
+        r->slots[i] = calloc(1, r->bufsz);
+        if (r->slots[i] == NULL) {
+            goto fail;
+        }
+    }
+    r->thread = dsv_thread_start(readahead, r);
+    if (r->thread == NULL) {
+        goto fail;
+    }
+    return 1;
+fail:
+    for (i = 0; i < YUV_RA_FRAMES; i++) {
+        if (r->slots[i]) {
+            free(r->slots[i]);
+            r->slots[i] = NULL;
+        }
+    }
+    dsv_cond_free(r->cond);
+    dsv_mutex_free(r->lock);
+    r->cond = NULL;
+    r->lock = NULL;
+    return 0;
+}
+
+/* skip forward in a stream that can't seek */
+static int
+skip_frames(YUV_READER *r, long n)
+{
+    while (n-- > 0) {
+        if (!read_whole(r->fp, r->buf, r->framesz)) {
+            return 0;
+        }
+        r->pos++;
+    }
+    return 1;
+}
+
+extern int
+yuv_open_reader(YUV_READER *r, char *path, int w, int h, int subsamp)
+{
+    memset(r, 0, sizeof(*r));
+    r->w = w;
+    r->h = h;
+    r->subsamp = subsamp;
+    r->framesz = yuv_frame_size(w, h, subsamp);
+    if (r->framesz == 0) {
+        DSV_ERROR(("unsupported format"));
+        return 0;
+    }
+    /* a frame of luma extra to be safe */
+    r->bufsz = r->framesz + (size_t) w * h;
+    if (strcmp(path, "-") == 0) {
+        r->fp = stdin;
+    } else {
+        r->fp = fopen(path, "rb");
+        if (r->fp == NULL) {
+            return 0;
+        }
+        r->seekable = (fseek(r->fp, 0, SEEK_SET) == 0);
+    }
+    r->map = dsv_map_file(r->fp, &r->maplen);
+    if (r->map) {
+        DSV_INFO(("memory mapped input (%lu bytes)", (unsigned long) r->maplen));
+    }
+    return 1;
+}
+
+extern int
+yuv_open_synth(YUV_READER *r, int pattern, long nframes, int w, int h, int subsamp)
+{
+    memset(r, 0, sizeof(*r));
+    if (pattern <= SYNTH_NONE || pattern >= SYNTH_NPATTERNS) {
+        DSV_ERROR(("unknown synthetic pattern %d", pattern));
+        return 0;
+    }
+    r->w = w;
+    r->h = h;
+    r->subsamp = subsamp;
+    r->synth = pattern;
+    r->nsynth = nframes;
+    return 1;
+}
+
+extern DSV_FRAME *
+yuv_read_frame(YUV_READER *r, int fno)
+{
+    uint8_t *data = NULL;
+
+    if (fno < 0) {
+        return NULL;
+    }
+    if (r->synth) {
+        DSV_FRAME *f;
+        
+        if (fno >= r->nsynth) {
+            return NULL;
+        }
+        f = dsv_mk_frame(r->subsamp, r->w, r->h, 0);
+        synth_frame(f, r->synth, fno);
+        return f;
+    }
+    if (r->map) {
+        if ((size_t) (fno + 1) * r->framesz > r->maplen) {
+            return NULL;
+        }
+        data = r->map + (size_t) fno * r->framesz;
+        goto wrap;
+    }
+    if (r->thread == NULL && r->buf == NULL) {
+        /* first read, position the stream and decide how to read it */
+        if (r->seekable && fno > 0) {
+            if (fseek(r->fp, (long) ((size_t) fno * r->framesz), SEEK_SET)) {
+                return NULL;
+            }
+            r->pos = fno;
+        }
+        if (!start_readahead(r)) {
+            r->buf = calloc(1, r->bufsz);
+            if (r->buf == NULL) {
+                return NULL;
+            }
+        } else {
+            DSV_INFO(("reading input on a separate thread"));
+        }
+    }
+    if (r->thread) {
+        dsv_mutex_lock(r->lock);
+        if (r->held) { /* release the frame returned by the previous call */
+            r->held = 0;
+            r->nused++;
+            dsv_cond_broadcast(r->cond);
+        }
+        while (1) {
+            while (r->nread == r->nused && !r->eof) {
+                dsv_cond_wait(r->cond, r->lock);
+            }
+            if (r->nread == r->nused || fno < r->pos) {
+                dsv_mutex_unlock(r->lock);
+                return NULL;
+            }
+            if (r->pos == fno) {
+                break;
+            }
+            r->nused++; /* discard */
+            r->pos++;
+            dsv_cond_broadcast(r->cond);
+        }
+        data = r->slots[r->nused % YUV_RA_FRAMES];
+        r->held = 1;
+        r->pos++;
+        dsv_mutex_unlock(r->lock);
+        goto wrap;
+    }
+    if (r->pos != fno) {
+        if (r->seekable) {
+            if (fseek(r->fp, (long) ((size_t) fno * r->framesz), SEEK_SET)) {
+                return NULL;
+            }
+            r->pos = fno;
+        } else if (fno < r->pos || !skip_frames(r, fno - r->pos)) {
+            return NULL;
+        }
+    }
+    if (!read_whole(r->fp, r->buf, r->framesz)) {
+        return NULL;
+    }
+    r->pos++;
+    data = r->buf;
+wrap:
+    return dsv_load_planar_frame(r->subsamp, data, r->w, r->h);
+}
+
+extern long
+yuv_num_frames(YUV_READER *r)
+{
+    long pos, end;
+
+    if (r->synth) {
+        return r->nsynth;
+    }
+    if (r->map) {
+        return (long) (r->maplen / r->framesz);
+    }
+    if (!r->seekable || r->thread || r->buf) {
+        return -1; /* only known before the first read */
+    }
+    pos = ftell(r->fp);
+    if (pos < 0 || fseek(r->fp, 0, SEEK_END)) {
+        return -1;
+    }
+    end = ftell(r->fp);
+    if (fseek(r->fp, pos, SEEK_SET) || end < 0) {
+        return -1;
+    }
+    return (long) ((size_t) end / r->framesz);
+}
+
+extern void
+yuv_close_reader(YUV_READER *r)
+{
+    int i;
+
+    if (r->thread) {
+        dsv_mutex_lock(r->lock);
+        r->stop = 1;
+        dsv_cond_broadcast(r->cond);
+        dsv_mutex_unlock(r->lock);
+        dsv_thread_join(r->thread);
+        r->thread = NULL;
+        dsv_cond_free(r->cond);
+        dsv_mutex_free(r->lock);
+    }
+    for (i = 0; i < YUV_RA_FRAMES; i++) {
+        if (r->slots[i]) {
+            free(r->slots[i]);
+        }
+    }
+    if (r->buf) {
+        free(r->buf);
+    }
+    dsv_unmap_file(r->map, r->maplen);
+    if (r->fp && r->fp != stdin) {
+        fclose(r->fp);
+    }
+    memset(r, 0, sizeof(*r));
+}
+
+/* frames are written in the order they were queued, a frame number that
+ * doesn't follow the previous one is handled by seeking (or padding with
+ * zeroes when the output is a stream), the same way fseek past the end of
+ * a file behaves. */
+static int
+write_at(YUV_WRITER *w, long fno, uint8_t *data, size_t len)
+{
+    if (w->pos != fno) {
+        if (w->seekable) {
+            if (fseek(w->fp, (long) ((size_t) fno * len), SEEK_SET)) {
+                return 0;
+            }
+        } else {
+            size_t n;
+
+            if (fno < w->pos) {
+                return 0;
+            }
+            n = (size_t) (fno - w->pos) * len;
+            while (n-- > 0) {
+                if (fputc(0, w->fp) == EOF) {
+                    return 0;
+                }
+            }
+        }
+        w->pos = fno;
+    }
+    if (fwrite(data, 1, len, w->fp) != len) {
+        return 0;
+    }
+    w->pos++;
+    return 1;
+}
+
+static void
+writebehind(void *arg)
+{
+    YUV_WRITER *w = arg;
+    int i, ok;
+
+    while (1) {
+        dsv_mutex_lock(w->lock);
+        while (!w->stop && w->nwritten == w->nqueued) {
+            dsv_cond_wait(w->cond, w->lock);
+        }
+        if (w->nwritten == w->nqueued) { /* stopped and nothing left */
+            dsv_mutex_unlock(w->lock);
+            break;
+        }
+        i = w->nwritten % YUV_WB_FRAMES;
+        dsv_mutex_unlock(w->lock);
+
+        ok = write_at(w, w->slotfno[i], w->slots[i], w->slotlen[i]);
+
+        dsv_mutex_lock(w->lock);
+        if (!ok) {
+            w->err = 1;
+        }
+        w->nwritten++;
+        dsv_cond_broadcast(w->cond);
+        dsv_mutex_unlock(w->lock);
+    }
+    fflush(w->fp);
+}
+
+static int
+start_writebehind(YUV_WRITER *w)
+{
+    w->lock = dsv_mutex_new();
+    w->cond = dsv_cond_new();
+    if (w->lock == NULL || w->cond == NULL) {
+        goto fail;
+    }
+    w->thread = dsv_thread_start(writebehind, w);
+    if (w->thread == NULL) {
+        goto fail;
+    }
+    return 1;
+fail:
+    dsv_cond_free(w->cond);
+    dsv_mutex_free(w->lock);
+    w->cond = NULL;
+    w->lock = NULL;
+    return 0;
+}
+
+extern int
+yuv_open_writer(YUV_WRITER *w, char *path)
+{
+    memset(w, 0, sizeof(*w));
+    if (strcmp(path, "-") == 0) {
+        w->fp = stdout;
+    } else {
+        w->fp = fopen(path, "wb");
+        if (w->fp == NULL) {
+            return 0;
+        }
+        w->seekable = 1;
+    }
+    if (start_writebehind(w)) {
+        DSV_INFO(("writing output on a separate thread"));
+    }
+    return 1;
+}
+
+/* pack the planes into one contiguous slot, growing it if needed */
+static int
+pack_planes(uint8_t **slot, size_t *cap, size_t *len, DSV_PLANE *p)
+{
+    size_t framesz;
+    uint8_t *d;
+    int c, y;
+
+    framesz = (size_t) p[0].w * p[0].h
+            + (size_t) p[1].w * p[1].h
+            + (size_t) p[2].w * p[2].h;
+    if (*cap < framesz) {
+        if (*slot) {
+            free(*slot);
+        }
+        *slot = malloc(framesz);
+        if (*slot == NULL) {
+            *cap = 0;
+            return 0;
+        }
+        *cap = framesz;
+    }
+    d = *slot;
+    for (c = 0; c < 3; c++) {
+        for (y = 0; y < p[c].h; y++) {
+            memcpy(d, DSV_GET_LINE(&p[c], y), p[c].w);
+            d += p[c].w;
+        }
+    }
+    *len = framesz;
+    return 1;
+}
+
+extern int
+yuv_write_frame(YUV_WRITER *w, int fno, DSV_PLANE *p)
+{
+    int i;
+
+    if (w->fp == NULL || fno < 0) {
+        return -1;
+    }
+    if (w->thread == NULL) {
+        if (!pack_planes(&w->slots[0], &w->slotcap[0], &w->slotlen[0], p) ||
+            !write_at(w, fno, w->slots[0], w->slotlen[0])) {
+            w->err = 1;
+        }
+        return w->err ? -1 : 0;
+    }
+    dsv_mutex_lock(w->lock);
+    while ((w->nqueued - w->nwritten) >= YUV_WB_FRAMES) {
+        dsv_cond_wait(w->cond, w->lock);
+    }
+    i = w->nqueued % YUV_WB_FRAMES;
+    dsv_mutex_unlock(w->lock);
+
+    /* the slot is not touched by the thread until it has been queued */
+    if (!pack_planes(&w->slots[i], &w->slotcap[i], &w->slotlen[i], p)) {
+        w->err = 1;
+        return -1;
+    }
+    w->slotfno[i] = fno;
+
+    dsv_mutex_lock(w->lock);
+    w->nqueued++;
+    dsv_cond_broadcast(w->cond);
+    i = w->err;
+    dsv_mutex_unlock(w->lock);
+    return i ? -1 : 0;
+}
+
+extern int
+yuv_close_writer(YUV_WRITER *w)
+{
+    int i, err;
+
+    if (w->thread) {
+        dsv_mutex_lock(w->lock);
+        w->stop = 1;
+        dsv_cond_broadcast(w->cond);
+        dsv_mutex_unlock(w->lock);
+        dsv_thread_join(w->thread);
+        dsv_cond_free(w->cond);
+        dsv_mutex_free(w->lock);
+    }
+    for (i = 0; i < YUV_WB_FRAMES; i++) {
+        if (w->slots[i]) {
+            free(w->slots[i]);
+        }
+    }
+    err = w->err;
+    if (w->fp) {
+        if (w->fp == stdout) {
+            if (fflush(w->fp)) {
+                err = 1;
+            }
+        } else if (fclose(w->fp)) {
+            err = 1;
+        }
+    }
+    memset(w, 0, sizeof(*w));
+    return err ? -1 : 0;
+}
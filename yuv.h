@@ -0,0 +1,117 @@
+/*****************************************************************************/
+/*
+ * Digital Subband Video 1
+ *   DSV-1
+ *   
+ *     -
+ *    =--  2023-2024 EMMIR
+ *   ==---  Envel Graphics
+ *  ===----
+ *  
+ *   GitHub : https://github.com/LMP88959
+ *   YouTube: https://www.youtube.com/@EMMIR_KC/videos
+ *   Discord: https://discord.com/invite/hdYctSmyQJ
+ */
+/*****************************************************************************/
+
+#ifndef _YUV_H_
+#define _YUV_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "dsv.h"
+#include "platform.h"
+
+/* raw planar YUV input
+ *
+ * "-" as the path reads from stdin. Regular files are memory mapped when
+ * DSV_MMAP is enabled and the frames returned are views into the mapping.
+ * Otherwise the file is read sequentially, with a background thread reading
+ * ahead when DSV_MT is enabled.
+ * A reader can also generate a synthetic sequence (see synth.h) instead.
+ */
+#define YUV_RA_FRAMES 4 /* number of frames to read ahead */
+
+typedef struct {
+    FILE *fp;
+    int w, h, subsamp;
+    size_t framesz;
+    size_t bufsz; /* of the frame buffers, framesz plus padding */
+    int seekable;
+    long pos; /* frame number the stream is currently at */
+
+    uint8_t *map;
+    size_t maplen;
+
+    uint8_t *buf; /* used when reading synchronously */
+
+    /* read ahead */
+    DSV_THREAD *thread;
+    DSV_MUTEX *lock;
+    DSV_COND *cond;
+    uint8_t *slots[YUV_RA_FRAMES];
+    long nread; /* total frames read by the thread */
+    long nused; /* total frames consumed */
+    int held; /* a slot is being used by the caller */
+    int eof;
+    int stop;
+
+    int synth; /* pattern, SYNTH_NONE when reading a file */
+    long nsynth; /* length of the synthetic sequence */
+} YUV_READER;
+
+extern int yuv_open_reader(YUV_READER *r, char *path, int w, int h, int subsamp);
+extern int yuv_open_synth(YUV_READER *r, int pattern, long nframes, int w, int h, int subsamp);
+/* returns a frame that is only valid until the next call, NULL when the
+ * frame could not be read (end of file or error). Frame numbers must not
+ * go backwards when reading from a stream. */
+extern DSV_FRAME *yuv_read_frame(YUV_READER *r, int fno);
+extern void yuv_close_reader(YUV_READER *r);
+/* number of frames in the input, -1 if it is a stream of unknown length */
+extern long yuv_num_frames(YUV_READER *r);
+
+/* raw planar YUV output
+ *
+ * "-" as the path writes to stdout. Frames are packed into one contiguous
+ * buffer and written with a single call. When DSV_MT is enabled the writes
+ * happen on a background thread so the caller only waits when
+ * YUV_WB_FRAMES frames are already queued.
+ */
+#define YUV_WB_FRAMES 4 /* number of frames that can be queued for writing */
+
+typedef struct {
+    FILE *fp;
+    int seekable;
+    long pos; /* frame number the stream is currently at */
+    int err;
+
+    /* write behind */
+    DSV_THREAD *thread;
+    DSV_MUTEX *lock;
+    DSV_COND *cond;
+    uint8_t *slots[YUV_WB_FRAMES];
+    size_t slotcap[YUV_WB_FRAMES];
+    size_t slotlen[YUV_WB_FRAMES];
+    long slotfno[YUV_WB_FRAMES];
+    long nqueued; /* total frames queued */
+    long nwritten; /* total frames written by the thread */
+    int stop;
+} YUV_WRITER;
+
+extern int yuv_open_writer(YUV_WRITER *w, char *path);
+/* the planes are copied, they can be reused as soon as this returns.
+ * returns -1 if this or any previous write failed */
+extern int yuv_write_frame(YUV_WRITER *w, int fno, DSV_PLANE *p);
+/* waits for all queued frames to be written, returns -1 if any failed */
+extern int yuv_close_writer(YUV_WRITER *w);
+
+/* size in bytes of one frame in a .yuv file */
+extern size_t yuv_frame_size(int w, int h, int subsamp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif